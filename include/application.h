@@ -11,14 +11,34 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <stb_image.h>
 #include <tiny_obj_loader.h>
 
+#include "mesh_cache.h"
+#include "weld_table.h"
+#include "mesh_optimizer.h"
+#include "thread_pool.h"
+#include "mipmap.h"
+#include "texture.h"
+#include "staging_ring.h"
+#include "gpu_allocator.h"
+#include "geometry_arena.h"
+#include "uniform_ring.h"
+#include "timeline_semaphore.h"
+#include "pipeline_cache.h"
+#include "pipeline_registry.h"
+#include "shader_compiler.h"
+#include "shader_watcher.h"
+
 #include <set>
 #include <array>
+#include <deque>
 #include <vector>
+#include <memory>
+#include <future>
 #include <unordered_map>
 #include <chrono>
 #include <fstream>
@@ -30,6 +50,7 @@
 
 #include <cstring>
 #include <cstdlib>
+#include <cmath>
 
 #ifdef NDEBUG
 const bool enable_validation_layers = false;
@@ -43,13 +64,67 @@ const uint32_t HEIGHT = 600;
 const std::string MODEL_PATH = "models/sponza.obj";
 const std::string TEXTURE_PATH = "textures/null.png";
 
+//GLSL, compiled in-process and cached as SPIR-V under cache/shaders
+const std::string SHADER_DIR = "shaders";
+const std::string VERTEX_SHADER_PATH = SHADER_DIR + "/shader.vert";
+const std::string PACKED_VERTEX_SHADER_PATH = SHADER_DIR + "/shader_packed.vert";
+const std::string FRAGMENT_SHADER_PATH = SHADER_DIR + "/shader.frag";
+
+//false falls back to the single threaded tinyobj::LoadObj for comparison
+const bool use_parallel_obj_parser = true;
+const bool use_mesh_cache = true;
+//false welds through std::unordered_map for comparison
+const bool use_weld_table = true;
+//reorder triangles and vertices for the post-transform cache before upload, logs ACMR/ATVR
+const bool use_mesh_optimizer = true;
+//16 byte PackedVertex + shader_packed.vert instead of the 32 byte Vertex
+const bool use_packed_vertices = true;
+//split into submeshes of at most 65535 vertices drawn with uint16 indices and a base vertex
+const bool use_16bit_indices = true;
+//draw meshlets through per-frame indirect buffers, zeroing the ones outside the frustum or facing away
+const bool use_meshlet_culling = true;
+//simplified LODs sharing the vertex buffer, one picked per frame by lod_policy (L cycles, F2 runs the distance sweep)
+const bool use_lod_chain = true;
+static_assert(!use_lod_chain || use_meshlet_culling, "LODs are selected through the meshlet indirect buffers");
+//group faces by material and record draws sorted by it, false keeps file order and rebinds the material set before every draw
+const bool use_material_sorting = true;
+//parse the model and decode textures on thread_pool, drawing null.png and an empty mesh until each upload lands
+const bool use_background_loading = true;
+const uint32_t MAX_TEXTURE_UPLOADS_PER_FRAME = 4;
+//full mip chain per texture, blitted on the GPU or downsampled on the loader thread if the format can't be blitted
+const bool use_mipmaps = true;
+//prefer a .ktx2 next to each png/jpg (BC1/BC3/BC7 with its own mips) when the device has textureCompressionBC
+const bool use_ktx2_textures = true;
+//encode other png/jpg textures to BC1 (opaque) or BC7 (alpha) on the pool, cached as KTX2 under cache/textures
+const bool use_texture_compression = true;
+//copy uploads on a transfer-only queue family when there is one, handing ownership to graphics afterwards
+const bool use_transfer_queue = true;
+//seed pipeline creation from cache/pipelines.bin and write it back at exit, false compiles cold every launch
+const bool use_pipeline_cache = true;
+//watch SHADER_DIR with inotify, recompile changed sources on thread_pool and swap the pipelines in between frames
+const bool use_shader_hot_reload = true;
+
+//every frame's draw list is split across this many secondary command buffers, each recorded on record_pool
+const uint32_t RECORD_THREADS = 4;
+const uint32_t MIN_DRAWS_PER_RECORD_JOB = 64;
+//F3: time recording the draw list repeated up to this many draws for 1 to RECORD_THREADS threads
+const uint32_t RECORD_BENCHMARK_DRAWS = 16384;
+const int RECORD_BENCHMARK_FRAMES = 50;
+
+const uint32_t MAX_LOD_COUNT = 5;
+const float LOD_ERROR_PIXELS = 1.0f;
+const float LOD_FULL_DETAIL_RADIUS = 512.0f; //projected radius in pixels below which screen_size starts dropping LODs
+const int LOD_SWEEP_STOPS = 8;
+const int LOD_SWEEP_FRAMES = 120;
+
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
 const std::vector<const char *> validation_layers = {
     "VK_LAYER_KHRONOS_validaton"};
 
 const std::vector<const char *> device_extensions = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME};
 
 VkResult create_debug_utils_messengerEXT( //proxy creation func
     VkInstance instance,
@@ -66,6 +141,7 @@ struct QueueFamilyIndices
 {
     std::optional<uint32_t> graphics_family;
     std::optional<uint32_t> present_family;
+    std::optional<uint32_t> transfer_family; //transfer only, if the device has one; not required
 
     bool is_complete()
     {
@@ -138,14 +214,138 @@ namespace std
     {
         size_t operator()(Vertex const &vertex) const
         {
-            return ((hash<glm::vec3>()(vertex.pos) ^
-                     (hash<glm::vec3>()(vertex.color) << 1)) >>
-                    1) ^
-                   (hash<glm::vec2>()(vertex.txr_coord) << 1);
+            //bytewise like WeldTable, Vertex has no padding
+            return static_cast<size_t>(hash_bytes(&vertex, sizeof(Vertex)));
         }
     };
 }
 
+enum class LodPolicy
+{
+    full,         //always LOD 0
+    screen_size,  //one LOD down every time the projected radius halves
+    screen_error, //coarsest LOD whose simplification error stays under LOD_ERROR_PIXELS
+    count
+};
+
+inline const char *lod_policy_name(LodPolicy policy)
+{
+    switch (policy)
+    {
+    case LodPolicy::full:
+        return "full";
+    case LodPolicy::screen_size:
+        return "screen size";
+    case LodPolicy::screen_error:
+        return "screen error";
+    default:
+        return "?";
+    }
+}
+
+//one level of the LOD chain, drawn as meshlets[first_meshlet, first_meshlet + meshlet_count)
+struct MeshLod
+{
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+    uint32_t triangle_count;
+    float error; //accumulated simplification error in OBJ units
+};
+
+//meshlets[first_meshlet, first_meshlet + meshlet_count) of one LOD that share a material, recorded as one indirect draw
+struct DrawRange
+{
+    uint32_t material;
+    uint32_t lod;
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+};
+
+//one entry of the per-frame draw list, indirect_count > 0 draws that many commands of the frame's indirect buffer instead
+struct DrawCommand
+{
+    uint32_t material;
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t first_indirect;
+    uint32_t indirect_count;
+};
+
+//packed positions are stored relative to these
+struct MeshBounds
+{
+    glm::vec3 min;
+    glm::vec3 extent;
+
+    //maps unorm positions back into model space
+    glm::mat4 dequantize() const
+    {
+        return glm::scale(glm::translate(glm::mat4(1.0f), min), extent);
+    }
+};
+
+/*16 byte alternative to Vertex: unorm16 position within the mesh bounds (w unused),
+octahedral snorm16 normal and half float texture coordinates.*/
+struct PackedVertex
+{
+    uint64_t pos;
+    uint32_t normal;
+    uint32_t txr_coord;
+
+    static PackedVertex pack(const Vertex &vertex, const MeshBounds &bounds)
+    {
+        PackedVertex packed{};
+
+        glm::vec3 pos = (vertex.pos - bounds.min) / bounds.extent;
+        packed.pos = glm::packUnorm4x16(glm::vec4(pos, 0.0f));
+
+        //Vertex keeps the normal remapped to [0,1] in color
+        glm::vec3 n = 2.0f * vertex.color - glm::vec3(1.0f);
+        float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        glm::vec2 oct = l1 > 0.0f ? glm::vec2(n.x / l1, n.y / l1) : glm::vec2(0.0f);
+        if (n.z < 0.0f)
+            oct = glm::vec2((1.0f - std::abs(oct.y)) * (oct.x >= 0.0f ? 1.0f : -1.0f),
+                            (1.0f - std::abs(oct.x)) * (oct.y >= 0.0f ? 1.0f : -1.0f));
+        packed.normal = glm::packSnorm2x16(oct);
+
+        packed.txr_coord = glm::packHalf2x16(vertex.txr_coord);
+        return packed;
+    }
+
+    static VkVertexInputBindingDescription get_binding_description()
+    {
+        VkVertexInputBindingDescription binding_description{};
+        binding_description.binding = 0;
+        binding_description.stride = sizeof(PackedVertex);
+        binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return binding_description;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 3> get_attribute_descriptions()
+    {
+        std::array<VkVertexInputAttributeDescription, 3> attribute_descriptions{};
+
+        attribute_descriptions[0].binding = 0;
+        attribute_descriptions[0].location = 0;
+        attribute_descriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attribute_descriptions[0].offset = offsetof(PackedVertex, pos);
+
+        attribute_descriptions[1].binding = 0;
+        attribute_descriptions[1].location = 1;
+        attribute_descriptions[1].format = VK_FORMAT_R16G16_SNORM;
+        attribute_descriptions[1].offset = offsetof(PackedVertex, normal);
+
+        attribute_descriptions[2].binding = 0;
+        attribute_descriptions[2].location = 2;
+        attribute_descriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+        attribute_descriptions[2].offset = offsetof(PackedVertex, txr_coord);
+
+        return attribute_descriptions;
+    }
+};
+
 class Application
 {
 public:
@@ -154,6 +354,9 @@ public:
 private:
     GLFWwindow *window;
 
+    ThreadPool thread_pool;
+    ThreadPool record_pool{RECORD_THREADS - 1}; //the main thread records a share too
+
     VkInstance instance;
     VkDebugUtilsMessengerEXT debug_messenger;
     VkSurfaceKHR surface;
@@ -163,8 +366,10 @@ private:
 
     VkQueue graphics_queue;
     VkQueue present_queue;
+    VkQueue transfer_queue; //graphics_queue without a dedicated transfer family
+    uint32_t transfer_family;
 
-    VkSwapchainKHR swap_chain;
+    VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
     std::vector<VkImage> swap_chain_images;
     VkFormat swap_chain_image_format;
     VkExtent2D swap_chain_extent;
@@ -172,20 +377,76 @@ private:
     std::vector<VkFramebuffer> swap_chain_framebuffers;
 
     VkRenderPass render_pass;
-    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorSetLayout descriptor_set_layout; //set 0, shared by every swap chain image
+    VkDescriptorSetLayout material_set_layout; //set 1, per material
     VkPipelineLayout pipeline_layout;
-    VkPipeline graphics_pipeline;
-
-    VkCommandPool command_pool;
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE; //shared by every pipeline creation
+    bool pipeline_cache_warm = false; //seeded from a file that matched this device
+    PipelineRegistry pipelines; //compiles variants on thread_pool, opaque_pipeline stands in until they're done
+    uint32_t opaque_pipeline = 0;
+    uint32_t wireframe_pipeline = 0; //opaque_pipeline without fillModeNonSolid
+    bool wireframe_supported = false;
+    bool wireframe = false; //F4
+    ShaderWatcher shader_watcher;
+    std::future<std::vector<std::vector<char>>> shader_compile; //vertex shaders by vertex format, then the fragment shader
+    bool shader_changed = false; //seen while shader_compile was still busy
+    bool shader_swap_pending = false; //reloaded pipelines still compiling
+    std::chrono::high_resolution_clock::time_point shader_change_time;
+    //replaced by a reload, destroyed once frame_timeline reaches the frame
+    std::deque<std::pair<uint64_t, VkPipeline>> retired_pipelines;
+
+    //per frame in flight, reset as a whole once the frame's fence has signalled
+    std::vector<VkCommandPool> command_pools;
+    std::vector<std::vector<VkCommandPool>> record_command_pools; //[frame][job], a pool is only ever used by one thread at a time
+    GpuAllocator gpu_allocator; //every buffer and image, sub-allocated out of shared blocks
+    VkBuffer staging_buffer;
+    GpuAllocation staging_buffer_memory;
+    StagingRing staging_ring; //every vertex, index and texture upload goes through it
+    //uploaded textures waiting for their staging batch before the material sets point at them
+    std::deque<std::pair<size_t, uint64_t>> texture_swaps;
+    std::vector<float> upload_frame_times; //ms, every frame drawn while textures are still on their way
 
     VkImage depth_image;
-    VkDeviceMemory depth_image_memory;
+    GpuAllocation depth_image_memory;
     VkImageView depth_image_view;
 
-    VkImage texture_image;
-    VkDeviceMemory texture_image_memory;
-    VkImageView texture_image_view;
+    //what a resize replaced, destroyed once frame_timeline reaches frame instead of waiting for the device
+    struct RetiredSwapChain
+    {
+        uint64_t frame;
+        VkSwapchainKHR swap_chain;
+        std::vector<VkImageView> image_views;
+        std::vector<VkFramebuffer> framebuffers;
+        VkImage depth_image;
+        GpuAllocation depth_image_memory;
+        VkImageView depth_image_view;
+    };
+    std::deque<RetiredSwapChain> retired_swap_chains;
+
+    //diffuse texture per entry of material_textures, shared by every material using the same file
+    std::vector<std::string> material_textures;
+    std::vector<VkImage> texture_images;
+    std::vector<GpuAllocation> texture_images_memory;
+    std::vector<VkImageView> texture_image_views;
     VkSampler texture_sampler;
+    bool blit_mipmaps = false; //R8G8B8A8_SRGB supports linear blits with optimal tiling
+    bool bc_textures = false;  //textureCompressionBC enabled on the device
+    VkDescriptorPool material_descriptor_pool = VK_NULL_HANDLE;
+    std::vector<std::vector<VkDescriptorSet>> material_descriptor_sets; //[frame][material]
+    std::vector<std::vector<size_t>> material_writes; //[frame], materials whose texture that frame's sets don't point at yet
+
+    //bound by every material until its own texture is uploaded
+    VkImage placeholder_image;
+    GpuAllocation placeholder_image_memory;
+    VkImageView placeholder_image_view;
+
+    //background loads, polled by the main loop; mesh_ready stays false until the buffers exist
+    std::future<void> model_load;
+    std::vector<std::future<TextureData>> texture_loads;
+    size_t texture_loads_pending = 0;
+    bool mesh_ready = false;
+    bool first_frame = true;
+    std::chrono::high_resolution_clock::time_point t_startup;
 
     /*Driver developers recommend that you also store multiple buffers, like the vertex and index buffer, 
     into a single VkBuffer and use offsets in commands like vkCmdBindVertexBuffers. 
@@ -193,28 +454,83 @@ private:
     It is even possible to reuse the same chunk of memory for multiple resources 
     if they are not used during the same render operations, provided that their data is refreshed, of course. 
     This is known as aliasing and some Vulkan functions have explicit flags to specify that you want to do this.
-    https://vulkan-tutorial.com/en/Vertex_buffers/Index_buffer*/
+    https://vulkan-tutorial.com/en/Vertex_buffers/Index_buffer
+    All of it goes into geometry_buffer, which geometry_arena hands out to the meshes.*/
 
     std::vector<Vertex> vertices;
+    std::vector<PackedVertex> packed_vertices;
+    MeshBounds mesh_bounds{};
     std::vector<uint32_t> indices;
-    VkBuffer vertex_buffer;
-    VkDeviceMemory vertex_buffer_memory;
-    VkBuffer index_buffer;
-    VkDeviceMemory index_buffer_memory;
-
-    std::vector<VkBuffer> uniform_buffers;
-    std::vector<VkDeviceMemory> uniform_buffers_memory;
+    std::vector<uint16_t> indices16;
+    std::vector<Submesh> submeshes;
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshLod> lods;
+    std::vector<DrawRange> draw_ranges;
+    glm::vec3 mesh_center{}; //bounding sphere of LOD 0 in OBJ space
+    float mesh_radius = 0.0f;
+    uint32_t vertex_count = 0;
+    uint32_t index_count = 0;
+    MeshCache mesh_cache; //mapped on warm starts until the buffers are uploaded
+    VkBuffer geometry_buffer = VK_NULL_HANDLE;
+    GpuAllocation geometry_buffer_memory;
+    GeometryArena geometry_arena;
+    GeometryAllocation mesh_geometry; //the model's range of the arena
+
+    //a region per frame in flight, set 0 is bound at the frame's region
+    VkBuffer uniform_buffer = VK_NULL_HANDLE;
+    GpuAllocation uniform_buffer_memory;
+    UniformRing uniform_ring;
+
+    //one VkDrawIndexedIndirectCommand per meshlet, rewritten by cull_meshlets every frame
+    std::vector<VkBuffer> indirect_buffers;
+    std::vector<GpuAllocation> indirect_buffers_memory;
+    bool multi_draw_indirect = false;
+    uint64_t triangles_submitted = 0;
+    uint64_t triangles_culled = 0;
+    //per frame, fixed when the command buffers are recorded
+    uint32_t descriptor_binds = 0;
+    uint32_t draw_calls = 0;
+
+    LodPolicy lod_policy = LodPolicy::screen_error;
+    uint32_t current_lod = 0;
+
+    //F2: for every policy, back the camera away from the mesh in LOD_SWEEP_STOPS doublings
+    struct LodSweep
+    {
+        bool active = false;
+        int policy = 0;
+        int stop = 0;
+        int frame = 0;
+        float frame_time = 0.0f;
+        uint64_t triangles = 0;
+        LodPolicy saved_policy;
+        glm::vec3 saved_camera_pos;
+    } lod_sweep;
 
     VkDescriptorPool descriptor_pool;
-    std::vector<VkDescriptorSet> descriptor_sets;
+    VkDescriptorSet descriptor_set; //dynamic offset into uniform_ring
 
-    std::vector<VkCommandBuffer> command_buffers;
+    std::vector<VkCommandBuffer> command_buffers; //primary per frame in flight
+    std::vector<std::vector<VkCommandBuffer>> secondary_command_buffers; //[frame][job]
+    std::vector<DrawCommand> draw_list;
+    std::vector<uint8_t> meshlet_visible; //written by cull_meshlets
+    uint32_t record_threads = RECORD_THREADS;
+    float record_ms = 0.0f;
 
+    //binary, the swap chain can't use timeline semaphores
     std::vector<VkSemaphore> image_available_semaphores;
     std::vector<VkSemaphore> render_finished_semaphores;
-    std::vector<VkFence> in_flight_fences;
-    std::vector<VkFence> images_in_flight;
-    size_t current_frame = 0;
+    /*Reaches N once frame N has finished on the GPU. Everything per frame in flight (command buffers,
+    uniform region, indirect buffer, the binary semaphores) is reused by frame N + MAX_FRAMES_IN_FLIGHT,
+    which waits for N and nothing else.*/
+    VkSemaphore frame_timeline;
+    uint64_t frame_number = 0; //last submitted
+    size_t current_frame = 0; //frame_number % MAX_FRAMES_IN_FLIGHT for the frame being built
+    uint64_t upload_dependency = 0; //staging batch the next frame waits for on the GPU
+    //CPU time frames spent waiting on the timeline, averaged into the title once a second
+    float blocked_ms = 0.0f;
+    float blocked_ms_sum = 0.0f;
+    uint32_t blocked_frames = 0;
 
     bool framebuffer_resized = false;
 
@@ -237,6 +553,17 @@ private:
     float m_lasty = (float)HEIGHT / 2.0f;
 
     void load_model();
+    std::vector<uint32_t> load_materials(const std::vector<tinyobj::material_t> &materials);
+    void group_by_material(const std::vector<uint32_t> &triangle_materials);
+    void optimize_mesh();
+    void build_submeshes();
+    void build_lods(std::vector<std::vector<Submesh>> &lod_submeshes);
+    void build_meshlets(const std::vector<std::vector<Submesh>> &lod_submeshes);
+    void compute_mesh_sphere();
+    void pack_vertices();
+    void upload_model();
+    void poll_loads();
+    float startup_ms() const;
     void process_input();
     void process_timing(bool show_fps);
 
@@ -245,7 +572,8 @@ private:
     void main_loop();
     void cleanup();
 
-    void clean_swap_chain();
+    void retire_swap_chain();
+    void destroy_retired_swap_chains(uint64_t completed_frame);
     void recreate_swap_chain();
 
     void create_instance();
@@ -261,9 +589,15 @@ private:
     void create_image_views();
     void create_render_pass();
     void create_descriptor_layout();
-    void create_graphics_pipeline();
+    void create_pipeline_cache();
+    void create_pipeline_layout();
+    void create_pipeline_registry();
+    std::vector<std::vector<char>> compile_shaders();
+    void poll_shaders();
+    void destroy_retired_pipelines(uint64_t completed_frame);
     void create_framebuffers();
-    void create_command_pool();
+    void create_command_pools();
+    void create_staging_ring();
 
     void create_depth_resources();
     VkFormat find_depth_format();
@@ -271,39 +605,56 @@ private:
                                    VkImageTiling tiling, VkFormatFeatureFlags features);
     bool has_stencil_component(VkFormat format);
 
-    void create_texture_image();
-    void create_texture_image_view();
+    static TextureData load_texture(const std::string &path, bool cpu_mipmaps, bool bc_supported, ThreadPool &pool);
+    void create_texture_image(const TextureData &texture, VkImage &image, GpuAllocation &image_memory);
+    void generate_mipmaps(VkCommandBuffer command_buffer, VkImage image, int32_t width, int32_t height, uint32_t mip_levels);
+    void create_placeholder_texture();
+    void upload_texture(size_t material, const TextureData &texture);
+    void acquire_image(VkImage image, uint32_t mip_levels, VkImageLayout new_layout);
     void create_texture_sampler();
+    void report_upload_frame_times();
+    void create_material_descriptor_sets();
+    void write_material_descriptor(size_t frame, size_t material, VkImageView image_view);
 
-    VkImageView create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags);
-    void create_image(uint32_t width, uint32_t height, VkFormat format,
+    VkImageView create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags, uint32_t mip_levels);
+    void create_image(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format,
                       VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-                      VkImage &image, VkDeviceMemory &imageMemory);
-    void transition_image_layout(VkImage image, VkFormat format,
-                                 VkImageLayout old_layout, VkImageLayout new_layout);
-    void copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+                      VkImage &image, GpuAllocation &image_memory);
+    void transition_image_layout(VkCommandBuffer command_buffer, VkImage image,
+                                 VkImageLayout old_layout, VkImageLayout new_layout, uint32_t mip_levels);
+    void upload_image_levels(VkImage image, const TextureData &texture);
 
-    void create_vertex_buffer();
-    void create_index_buffer();
-    void create_uniform_buffers();
+    void create_geometry_arena(VkDeviceSize min_size);
+    void upload_geometry();
+    void create_uniform_ring();
+    void create_indirect_buffers();
 
     void create_descriptor_pool();
-    void create_descriptor_sets();
+    void create_descriptor_set();
 
     void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                       VkBuffer &buffer, VkDeviceMemory &buffer_memory);
-    VkCommandBuffer begin_single_time_commands();
-    void end_single_time_commands(VkCommandBuffer command_buffer);
-    void copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size);
-    uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties);
+                       VkBuffer &buffer, GpuAllocation &buffer_memory);
+    void upload_buffer(VkBuffer buffer, VkDeviceSize buffer_offset, const void *data, VkDeviceSize size);
 
     void create_command_buffers();
-
-    void update_uniform_buffer(uint32_t current_image);
+    void build_draw_list();
+    void record_command_buffer(uint32_t image_index);
+    void record_draws(VkCommandBuffer command_buffer, uint32_t image_index, size_t first, size_t count,
+                      uint32_t &binds, uint32_t &draws);
+    void benchmark_recording();
+
+    glm::mat4 model_matrix() const;
+    glm::mat4 mesh_to_world() const;
+    void update_uniform_buffer(uint32_t frame);
+    void cull_meshlets(uint32_t frame, const glm::mat4 &view, const glm::mat4 &proj);
+    uint32_t select_lod(const glm::vec3 &camera, float pixels_per_unit) const;
+    void start_lod_sweep();
+    void step_lod_sweep();
+    float lod_sweep_distance() const;
+    void move_lod_sweep_camera();
     void draw_frame();
     void create_sync_objects();
 
-    VkShaderModule create_shader_module(const std::vector<char> &code);
     VkSurfaceFormatKHR choose_swap_surface_format(const std::vector<VkSurfaceFormatKHR> &available_formats);
     VkPresentModeKHR choose_swap_present_mode(const std::vector<VkPresentModeKHR> &available_present_modes);
     VkExtent2D choose_swap_extent(const VkSurfaceCapabilitiesKHR &capabilities);
@@ -327,23 +678,6 @@ private:
         return VK_FALSE;
     }
 
-    static std::vector<char> read_file(const std::string &filename)
-    {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-        if (!file.is_open())
-            throw std::runtime_error("failed to open file!");
-
-        size_t file_size = (size_t)file.tellg();
-        std::vector<char> buffer(file_size);
-
-        file.seekg(0);
-        file.read(buffer.data(), file_size);
-        file.close();
-
-        return buffer;
-    }
-
     static void framebuffer_resize_callback(GLFWwindow *window, int width, int height)
     {
         auto app = reinterpret_cast<Application *>(glfwGetWindowUserPointer(window));
@@ -363,6 +697,21 @@ private:
 
             app->m_captured = !app->m_captured;
         }
+
+        if (key == GLFW_KEY_L && action == GLFW_PRESS && !app->lod_sweep.active)
+        {
+            app->lod_policy = static_cast<LodPolicy>((static_cast<int>(app->lod_policy) + 1) % static_cast<int>(LodPolicy::count));
+            std::cout << "lod policy: " << lod_policy_name(app->lod_policy) << std::endl;
+        }
+
+        if (key == GLFW_KEY_F2 && action == GLFW_PRESS && use_lod_chain && app->mesh_ready && !app->lod_sweep.active)
+            app->start_lod_sweep();
+
+        if (key == GLFW_KEY_F3 && action == GLFW_PRESS && app->mesh_ready)
+            app->benchmark_recording();
+
+        if (key == GLFW_KEY_F4 && action == GLFW_PRESS && app->wireframe_supported)
+            app->wireframe = !app->wireframe;
     }
 
     static void mouse_callback(GLFWwindow *window, double xpos, double ypos)
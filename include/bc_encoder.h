@@ -0,0 +1,32 @@
+#ifndef BC_ENCODER_H
+#define BC_ENCODER_H
+
+#include <cstdint>
+#include <cstddef>
+
+/*Load time BCn compression for textures that only ship as png/jpg. Endpoints come from the
+block's bounding box (inset, diagonal picked by the sign of each channel's covariance with green),
+indices from projecting every texel onto the endpoint axis. The projection runs in AVX2 or SSE2
+when the CPU has it. Quality is that of a real-time encoder, well below an offline one.*/
+
+const uint32_t BC1_BLOCK_SIZE = 8;
+const uint32_t BC7_BLOCK_SIZE = 16;
+
+//true if any texel of the rgba8 image has alpha below 255
+bool has_alpha(const uint8_t *rgba, size_t pixel_count);
+
+//16 rgba8 texels in row order to one BC1 block in four colour mode, alpha is ignored
+void encode_bc1_block(const uint8_t *texels, uint8_t *block);
+
+//16 rgba8 texels in row order to one BC7 mode 6 block (one subset, rgba 7.7.7.7 + p-bit endpoints, 4 bit indices)
+void encode_bc7_block(const uint8_t *texels, uint8_t *block);
+
+/*Encodes block rows [first_row, first_row + row_count) of an rgba8 image into blocks, which points
+at the first block of the image. Blocks past the right/bottom edge repeat the last column/row.*/
+void encode_bc_rows(const uint8_t *rgba, uint32_t width, uint32_t height, bool bc7,
+                    uint32_t first_row, uint32_t row_count, uint8_t *blocks);
+
+//"avx2", "sse2" or "scalar", whichever projection the encoders use on this CPU
+const char *bc_encoder_kernel();
+
+#endif /*BC_ENCODER_H*/
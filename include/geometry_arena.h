@@ -0,0 +1,59 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <cstdint>
+
+const VkDeviceSize GEOMETRY_ARENA_SIZE = 128ull << 20;
+
+//where one mesh lives in the arena, first_index and base_vertex go straight into draw commands
+struct GeometryAllocation
+{
+    VkDeviceSize vertex_offset = 0; //bytes
+    VkDeviceSize vertex_size = 0;
+    VkDeviceSize index_offset = 0;
+    VkDeviceSize index_size = 0;
+    int32_t base_vertex = 0;
+    uint32_t first_index = 0;
+};
+
+/*Hands out ranges of one device local buffer that holds the vertices and indices of every mesh.
+The buffer is bound once at offset 0 as both vertex and index buffer, so a vertex range starts
+at a multiple of the vertex stride and an index range at a multiple of the index size, and the
+draws address them through firstIndex and vertexOffset. Free ranges are kept sorted by offset
+and merged with their neighbours; meshes come and go rarely enough that first fit is plenty.*/
+class GeometryArena
+{
+public:
+    GeometryArena() = default;
+    ~GeometryArena() = default;
+
+    GeometryArena(const GeometryArena &) = delete;
+    GeometryArena &operator=(const GeometryArena &) = delete;
+
+    //buffer stays owned by the caller
+    void create(VkBuffer buffer, VkDeviceSize size);
+    void destroy();
+
+    VkBuffer buffer() const { return arena_buffer; }
+
+    GeometryAllocation allocate(uint32_t vertex_count, VkDeviceSize vertex_stride, uint32_t index_count, VkDeviceSize index_stride);
+    void free(GeometryAllocation &allocation);
+
+    VkDeviceSize size() const { return arena_size; }
+    VkDeviceSize used() const { return used_bytes; }
+
+private:
+    VkDeviceSize allocate_range(VkDeviceSize size, VkDeviceSize alignment);
+    void free_range(VkDeviceSize offset, VkDeviceSize size);
+
+    VkBuffer arena_buffer = VK_NULL_HANDLE;
+    VkDeviceSize arena_size = 0;
+    VkDeviceSize used_bytes = 0;
+
+    std::map<VkDeviceSize, VkDeviceSize> free_ranges; //offset -> size
+};
+
+#endif /*GEOMETRY_ARENA_H*/
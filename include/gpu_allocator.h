@@ -0,0 +1,68 @@
+#ifndef GPU_ALLOCATOR_H
+#define GPU_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+const VkDeviceSize GPU_BLOCK_SIZE = 64ull << 20;
+//images at least this big get their own VkDeviceMemory, anything over half a block does too
+const VkDeviceSize GPU_DEDICATED_IMAGE_SIZE = 16ull << 20;
+
+struct GpuBlock;
+
+struct GpuAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint8_t *mapped = nullptr; //host visible memory stays mapped for its whole life
+    GpuBlock *block = nullptr; //null for dedicated allocations
+    uint32_t node = 0;
+    uint32_t pool = 0;
+};
+
+/*Sub-allocates resources out of GPU_BLOCK_SIZE blocks of VkDeviceMemory, one list of blocks per
+memory type. Each block is a TLSF heap (two level segregated fit, 16 second level bins, 256 byte
+granules), so allocation and free are O(1) and neighbouring free ranges coalesce right away.
+Linear and optimal tiling resources live in separate blocks whenever bufferImageGranularity is
+larger than 1, so they can never share a granularity page. Host visible blocks are mapped once.*/
+class GpuAllocator
+{
+public:
+    GpuAllocator();
+    ~GpuAllocator();
+
+    GpuAllocator(const GpuAllocator &) = delete;
+    GpuAllocator &operator=(const GpuAllocator &) = delete;
+
+    void create(VkPhysicalDevice physical_device, VkDevice device);
+    void destroy();
+
+    //linear: buffers and VK_IMAGE_TILING_LINEAR images
+    GpuAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear);
+    void free(GpuAllocation &allocation);
+
+    //one line: vkAllocateMemory count against the device limit, bytes in use and how fragmented the free space is
+    std::string stats() const;
+
+private:
+    uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) const;
+    VkDeviceMemory allocate_memory(uint32_t memory_type, VkDeviceSize size, uint8_t **mapped);
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memory_properties{};
+    VkDeviceSize buffer_image_granularity = 1;
+    uint32_t max_allocations = 0;
+
+    std::vector<VkDeviceSize> block_sizes; //per memory type, smaller than GPU_BLOCK_SIZE on small heaps
+    std::vector<std::vector<std::unique_ptr<GpuBlock>>> pools; //memory type * 2 + 1 for optimal tiling
+    uint32_t device_allocations = 0;
+    uint32_t dedicated_allocations = 0;
+    VkDeviceSize dedicated_bytes = 0;
+};
+
+#endif /*GPU_ALLOCATOR_H*/
@@ -0,0 +1,56 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+//murmur3 finalizer, full avalanche on 64 bits
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+//four independent lanes over 32 byte stripes so long inputs are not bound by multiply latency
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+    uint64_t lanes[4] = {seed ^ k, seed + k, seed ^ (k << 1), seed - k};
+    size_t remaining = size;
+
+    for (; remaining >= 32; remaining -= 32, p += 32)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            uint64_t word;
+            memcpy(&word, p + 8 * i, 8);
+            lanes[i] = (lanes[i] ^ mix64(word)) * k;
+        }
+    }
+
+    //up to three whole words left, then at most 7 bytes
+    for (int i = 0; remaining >= 8; i++, remaining -= 8, p += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        lanes[i] = (lanes[i] ^ mix64(word)) * k;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, p, remaining);
+
+    uint64_t h = mix64(size ^ tail);
+    for (int i = 0; i < 4; i++)
+        h = mix64(h ^ lanes[i]) * k;
+
+    return mix64(h);
+}
+
+#endif /*HASH_H*/
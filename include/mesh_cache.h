@@ -0,0 +1,93 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//bump whenever the blob layout or what load_model stores in it changes
+const uint32_t MESH_CACHE_VERSION = 9;
+
+const std::string MESH_CACHE_DIR = "cache";
+
+enum class MeshCacheSection : uint32_t
+{
+    vertices,
+    indices,
+    packed_vertices,
+    bounds,
+    indices16,
+    submeshes,
+    meshlets,
+    lods,
+    materials,
+    draw_ranges,
+    dependencies //written and checked by MeshCache itself
+};
+
+struct MeshCacheBlob
+{
+    MeshCacheSection section;
+    const void *data;
+    size_t size;
+};
+
+//the source and every dependency as they were before load_model read them, so edits made meanwhile make the blob stale
+struct MeshCacheStamp
+{
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    uint64_t source_hash = 0;
+    std::string dependencies; //records as written to the dependencies section
+};
+
+/*Binary blob of load_model results, one file per source path under MESH_CACHE_DIR.
+The header keys it to the source size, mtime and content hash and to a config fingerprint of
+every setting that changes what gets stored. Files the result depends on besides the source,
+like .mtl libraries, are checked the same way. A stale mtime alone only costs a rehash, not a
+reparse. open() maps the blob read only so sections can be copied straight into staging memory.*/
+class MeshCache
+{
+public:
+    MeshCache() = default;
+    ~MeshCache();
+
+    MeshCache(const MeshCache &) = delete;
+    MeshCache &operator=(const MeshCache &) = delete;
+
+    bool open(const std::string &source_path, uint64_t config);
+    void close();
+    bool is_open() const { return mapping != nullptr; }
+
+    bool has(MeshCacheSection section) const;
+    const void *data(MeshCacheSection section) const;
+    size_t size(MeshCacheSection section) const;
+
+    template <class T>
+    size_t count(MeshCacheSection section) const { return size(section) / sizeof(T); }
+
+    //dependencies that don't exist are stamped as missing, so the cache goes stale once they show up
+    static bool stamp(const std::string &source_path, const std::vector<std::string> &dependencies, MeshCacheStamp &stamp);
+    static bool store(const std::string &source_path, uint64_t config, const MeshCacheStamp &stamp,
+                      const std::vector<MeshCacheBlob> &blobs);
+
+private:
+    struct SectionEntry
+    {
+        uint32_t id;
+        uint32_t reserved;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+    const SectionEntry *sections = nullptr;
+    uint32_t section_count = 0;
+
+    const SectionEntry *find(MeshCacheSection section) const;
+    bool dependencies_match() const;
+};
+
+#endif /*MESH_CACHE_H*/
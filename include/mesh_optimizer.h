@@ -0,0 +1,83 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//0xffff stays free so primitive restart can be turned on without resplitting
+const uint32_t MAX_SUBMESH_VERTICES = 65535;
+
+//range of the index buffer drawn with its own base vertex and a single material
+struct Submesh
+{
+    uint32_t first_index;
+    uint32_t index_count;
+    int32_t vertex_offset;
+    uint32_t material;
+};
+
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+//contiguous index range of a submesh with bounds for culling, in the positions' space
+struct Meshlet
+{
+    uint32_t first_index;
+    uint32_t index_count;
+    int32_t vertex_offset;
+    float radius;
+    float center[3];
+    float cone_cutoff; //sine of the normals' spread around cone_axis, 1 if it can never be backface culled
+    float cone_axis[3];
+};
+
+//fifo size used to report cache efficiency, close to what current hardware reuses
+const uint32_t VERTEX_CACHE_ANALYSIS_SIZE = 16;
+
+struct VertexCacheStatistics
+{
+    float acmr; //transformed vertices per triangle, 0.5 is ideal for large grids
+    float atvr; //transformed vertices per referenced vertex, 1.0 is ideal
+};
+
+VertexCacheStatistics analyze_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                                           uint32_t cache_size = VERTEX_CACHE_ANALYSIS_SIZE);
+
+/*Reorders triangles in place for post-transform cache reuse using Forsyth's linear-speed
+vertex cache optimisation (simulated 32 entry LRU). Vertex order is left untouched. Scratch
+memory scales with the vertices the range references, so it is cheap to call per submesh.*/
+void optimize_vertex_cache(uint32_t *indices, size_t index_count);
+
+/*Moves vertices into the order the index buffer first references them and rewrites the
+indices to match, so fetches walk the vertex buffer mostly linearly. Unreferenced vertices
+are dropped, the new vertex count is returned.*/
+size_t optimize_vertex_fetch(void *vertices, size_t vertex_count, size_t vertex_size, uint32_t *indices, size_t index_count);
+
+/*Splits each of ranges, in order, into runs that reference at most max_vertices vertices each
+so every run can be drawn with 16 bit indices relative to its own vertex_offset. Runs never cross
+a range and inherit its material. vertex_remap receives the source vertex of every output vertex,
+vertices shared by two runs are duplicated. Ranges that already fit come back unsplit.*/
+std::vector<Submesh> split_submeshes(const uint32_t *indices, const std::vector<Submesh> &ranges, size_t vertex_count,
+                                     std::vector<uint16_t> &local_indices, std::vector<uint32_t> &vertex_remap,
+                                     uint32_t max_vertices = MAX_SUBMESH_VERTICES);
+
+/*Cuts every submesh, in index order, into meshlets of at most max_vertices unique vertices and
+max_triangles triangles. indices are global (vertex_offset already applied), positions are read as
+three floats every position_stride bytes. Triangle order is not changed, so meshlets draw straight
+out of the existing index buffer.*/
+std::vector<Meshlet> build_meshlets(const uint32_t *indices, const std::vector<Submesh> &submeshes,
+                                    const float *positions, size_t position_stride, size_t vertex_count,
+                                    uint32_t max_vertices = MESHLET_MAX_VERTICES, uint32_t max_triangles = MESHLET_MAX_TRIANGLES);
+
+/*Quadric error metric edge collapse (Garland/Heckbert). Vertices only collapse onto other
+existing vertices so the result indexes the same vertex buffer. Vertices on open borders and
+attribute seams (welding leaves those as separate vertices) are locked, as are non-manifold
+edges. Writes at most index_count indices to destination and returns how many were written;
+result_error receives the largest collapse error as an rms distance in position units. Only the
+vertices indices reference are touched, so simplifying a submesh costs nothing per vertex outside it.*/
+size_t simplify_mesh(uint32_t *destination, const uint32_t *indices, size_t index_count,
+                     const float *positions, size_t position_stride,
+                     size_t target_index_count, float *result_error);
+
+#endif /*MESH_OPTIMIZER_H*/
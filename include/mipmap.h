@@ -0,0 +1,20 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//levels of a full chain down to 1x1
+uint32_t mip_level_count(uint32_t width, uint32_t height);
+
+/*2x2 box filter of an rgba8 image into max(width / 2, 1) x max(height / 2, 1) pixels, odd
+dimensions drop their last row/column like a linear blit would. Averages the stored values, so
+sRGB textures come out slightly darker than a blit, which filters in linear space.*/
+void downsample_rgba8(const uint8_t *source, uint32_t width, uint32_t height, uint8_t *destination);
+
+/*CPU fallback for devices that can't blit the texture format with linear filtering. image holds
+level 0 of an rgba8 image, levels 1..mip_level_count - 1 are appended tightly packed.*/
+void build_mip_chain(std::vector<uint8_t> &image, uint32_t width, uint32_t height);
+
+#endif /*MIPMAP_H*/
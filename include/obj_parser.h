@@ -0,0 +1,23 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include <tiny_obj_loader.h>
+
+#include "thread_pool.h"
+
+#include <string>
+#include <vector>
+
+/*Multi-threaded replacement for tinyobj::LoadObj. The file is split into chunks at line
+boundaries, each chunk is parsed on the pool and the per-chunk results are merged in file order.
+Quads are split along the shorter diagonal like tinyobj, larger polygons are fan triangulated.
+Only v/vn/vt/f/o/g/s/usemtl/mtllib are understood, lines, points, tags and vertex colors are skipped.
+.mtl files are resolved relative to mtl_basedir, like tinyobj.*/
+bool load_obj_parallel(tinyobj::attrib_t *attrib, std::vector<tinyobj::shape_t> *shapes,
+                       std::vector<tinyobj::material_t> *materials, std::string *warn, std::string *err,
+                       const char *filename, ThreadPool &pool, const char *mtl_basedir = nullptr);
+
+//every .mtl named by a mtllib line, resolved the same way, so callers can track what the materials came from
+std::vector<std::string> find_material_libraries(const char *filename, const char *mtl_basedir = nullptr);
+
+#endif /*OBJ_PARSER_H*/
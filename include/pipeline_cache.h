@@ -0,0 +1,18 @@
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+const std::string PIPELINE_CACHE_PATH = "cache/pipelines.bin";
+
+/*VkPipelineCache seeded from PIPELINE_CACHE_PATH. The blob is only handed to the driver if its
+header (version one: vendorID, deviceID and pipelineCacheUUID) matches this device, a cache from
+another GPU or driver version starts out empty instead. warm tells which of the two happened.*/
+VkPipelineCache load_pipeline_cache(VkDevice device, const VkPhysicalDeviceProperties &properties, bool &warm);
+
+//written to a temporary file and renamed over PIPELINE_CACHE_PATH, false if anything failed
+bool store_pipeline_cache(VkDevice device, VkPipelineCache cache);
+
+#endif /*PIPELINE_CACHE_H*/
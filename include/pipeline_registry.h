@@ -0,0 +1,134 @@
+#ifndef PIPELINE_REGISTRY_H
+#define PIPELINE_REGISTRY_H
+
+#include <vulkan/vulkan.h>
+
+#include "thread_pool.h"
+#include "hash.h"
+
+#include <chrono>
+#include <future>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+enum class BlendMode : uint8_t
+{
+    opaque,
+    alpha,
+    additive
+};
+
+//everything a pipeline variant can differ in, compared and hashed as raw bytes so it has to stay free of padding
+struct PipelineKey
+{
+    uint8_t vertex_format = 0; //index into the vertex inputs given to create()
+    BlendMode blend = BlendMode::opaque;
+    uint8_t wireframe = 0;  //needs fillModeNonSolid
+    uint8_t depth_only = 0; //no fragment shader, color writes off
+
+    bool operator==(const PipelineKey &other) const { return memcmp(this, &other, sizeof(PipelineKey)) == 0; }
+};
+static_assert(sizeof(PipelineKey) == 4, "PipelineKey is hashed as raw bytes");
+
+struct PipelineKeyHash
+{
+    size_t operator()(const PipelineKey &key) const { return hash_bytes(&key, sizeof(key)); }
+};
+
+//one vertex format, the vertex shader reading it and its layout in the vertex buffer
+struct PipelineVertexInput
+{
+    std::vector<char> vertex_shader; //SPIR-V
+    VkVertexInputBindingDescription binding;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
+/*Every graphics pipeline, described by a PipelineKey. request() hands out one id per distinct key
+and compiles new ones on the thread pool, all through the same VkPipelineCache. Until a variant is
+done get() returns the fallback, which set_render_pass() compiles right away, so drawing never waits
+on the driver. Finished compiles are picked up by poll() on the thread that draws; the workers only
+ever touch state that stays the same while compiles are pending.*/
+class PipelineRegistry
+{
+public:
+    PipelineRegistry() = default;
+    ~PipelineRegistry() = default;
+
+    PipelineRegistry(const PipelineRegistry &) = delete;
+    PipelineRegistry &operator=(const PipelineRegistry &) = delete;
+
+    //pool has to outlive the registry, vertex_inputs are indexed by PipelineKey::vertex_format
+    void create(VkDevice device, VkPipelineCache cache, ThreadPool &pool,
+                const std::vector<PipelineVertexInput> &vertex_inputs, const std::vector<char> &fragment_shader);
+    void destroy();
+
+    /*Builds pipelines against render_pass and layout from now on. The fallback is compiled on the calling
+    thread, every variant requested so far is destroyed and compiled again on the pool.*/
+    void set_render_pass(VkRenderPass render_pass, VkPipelineLayout layout, const PipelineKey &fallback);
+
+    /*Compiles every variant again from new SPIR-V, indexed like the vertex inputs given to create(). The
+    old pipelines keep drawing until all replacements are done, then poll() swaps them in together.*/
+    void reload(const std::vector<std::vector<char>> &vertex_shaders, const std::vector<char> &fragment_shader);
+    //pipelines swapped out by a reload, frames in flight may still use them so the caller destroys them
+    std::vector<VkPipeline> take_retired();
+
+    //id of the variant with key, identical keys share one pipeline
+    uint32_t request(const PipelineKey &key);
+    //the fallback until id has finished compiling
+    VkPipeline get(uint32_t id) const;
+    bool is_ready(uint32_t id) const { return variants[id].pipeline != VK_NULL_HANDLE; }
+    const PipelineKey &key(uint32_t id) const { return variants[id].key; }
+
+    //picks up finished compiles without blocking, logs once a batch of requests is done
+    void poll();
+    void wait_idle();
+
+    size_t size() const { return variants.size(); }
+
+private:
+    struct Compiled
+    {
+        VkPipeline pipeline;
+        float ms;
+    };
+
+    struct Variant
+    {
+        PipelineKey key;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkPipeline replacement = VK_NULL_HANDLE; //compiled by a reload, waiting for the rest
+        std::future<Compiled> compile;
+    };
+
+    void compile(Variant &variant);
+    void finish(Variant &variant, bool wait);
+    Compiled build(const PipelineKey &key) const;
+    void create_modules(const std::vector<std::vector<char>> &vertex_shaders, const std::vector<char> &fragment_shader);
+    void destroy_modules();
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    ThreadPool *pool = nullptr;
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+
+    std::vector<PipelineVertexInput> vertex_inputs;
+    std::vector<VkShaderModule> vertex_modules;
+    VkShaderModule fragment_module = VK_NULL_HANDLE;
+
+    std::vector<Variant> variants;
+    std::unordered_map<PipelineKey, uint32_t, PipelineKeyHash> ids;
+    uint32_t fallback_id = 0;
+    std::vector<VkPipeline> retired;
+
+    //compiles queued since the pool was last idle, for the log
+    uint32_t pending = 0;
+    uint32_t batch_count = 0;
+    float batch_compile_ms = 0.0f;
+    bool batch_failed = false;
+    std::chrono::high_resolution_clock::time_point batch_start;
+};
+
+#endif /*PIPELINE_REGISTRY_H*/
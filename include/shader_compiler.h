@@ -0,0 +1,18 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//bump whenever the compile options change, stale SPIR-V is never looked at again
+const uint32_t SHADER_CACHE_VERSION = 2;
+
+const std::string SHADER_CACHE_DIR = "cache/shaders";
+
+/*GLSL to SPIR-V through shaderc, the stage comes from the extension (.vert or .frag). Results are
+cached under SHADER_CACHE_DIR by a hash of the source text, so an unchanged shader only costs a file
+read. Safe to call from any thread; throws with the compiler's messages if the source doesn't compile.*/
+std::vector<char> compile_shader(const std::string &source_path);
+
+#endif /*SHADER_COMPILER_H*/
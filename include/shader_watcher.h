@@ -0,0 +1,31 @@
+#ifndef SHADER_WATCHER_H
+#define SHADER_WATCHER_H
+
+#include <string>
+#include <vector>
+
+/*inotify watch on a directory of shader sources. Editors that save through a temporary file and a
+rename show up as IN_MOVED_TO, plain writes as IN_CLOSE_WRITE; both are reported once the file is
+complete, so it can be compiled right away.*/
+class ShaderWatcher
+{
+public:
+    ShaderWatcher() = default;
+    ~ShaderWatcher() { close(); }
+
+    ShaderWatcher(const ShaderWatcher &) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+    //false if inotify isn't available, poll() then never reports anything
+    bool watch(const std::string &directory);
+    void close();
+
+    //.vert and .frag paths changed since the last call, each once, never blocks
+    std::vector<std::string> poll();
+
+private:
+    int fd = -1;
+    std::string directory;
+};
+
+#endif /*SHADER_WATCHER_H*/
@@ -0,0 +1,117 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include <vulkan/vulkan.h>
+
+#include "timeline_semaphore.h"
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+const VkDeviceSize STAGING_RING_SIZE = 64ull << 20;
+//largest single copy, small enough that later chunks are written while the GPU copies earlier ones
+const VkDeviceSize STAGING_CHUNK_SIZE = STAGING_RING_SIZE / 4;
+
+/*One persistently mapped host visible buffer that every upload sub-allocates from, in order.
+Allocations go into the open batch together with the copies and barriers recorded into its
+command buffer; submit() hands the batch to the queue and returns its serial, and timeline()
+reaches that serial once the batch has completed. Its bytes are reclaimed as soon as the copies
+are done. Nothing here waits unless the ring is full or a caller asks to with wait().
+
+With a dedicated transfer queue every batch also has an acquire command buffer for the graphics
+queue, where the caller records the acquire half of its queue family ownership transfers (and
+anything that needs graphics, like mip blits). The transfer signals a second timeline, and the
+acquire is only submitted once that has reached the batch, so rendering never queues up behind
+a copy, unless a frame asks for the batch early through flush().*/
+class StagingRing
+{
+public:
+    StagingRing() = default;
+    ~StagingRing() = default;
+
+    StagingRing(const StagingRing &) = delete;
+    StagingRing &operator=(const StagingRing &) = delete;
+
+    //buffer stays owned by the caller, mapped is its host visible and coherent memory
+    void create(VkDevice device, VkQueue queue, uint32_t queue_family, VkQueue acquire_queue, uint32_t acquire_family,
+                VkBuffer buffer, uint8_t *mapped, VkDeviceSize size);
+    void destroy();
+
+    VkBuffer buffer() const { return ring_buffer; }
+    uint8_t *data(VkDeviceSize offset) const { return mapped + offset; }
+
+    //true if batches copy on another queue family than the one that uses the results
+    bool ownership_transfer() const { return acquire_family != queue_family; }
+    uint32_t family() const { return queue_family; }
+    uint32_t graphics_family() const { return acquire_family; }
+
+    //command buffers of the open batch, begun on first use. Without ownership transfer both are the same
+    VkCommandBuffer command_buffer();
+    VkCommandBuffer acquire_command_buffer();
+
+    /*Offset of size free bytes at a multiple of alignment, for the open batch. When the ring is full
+    it waits on the oldest submitted batches, submitting the open one first if that alone is in the way.*/
+    VkDeviceSize allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+    //ends the open batch and submits it, returns its serial or that of the last batch if nothing was recorded
+    uint64_t submit();
+
+    //submits acquires whose transfer has finished and retires what completed, never blocks
+    void poll();
+
+    //true once batch and everything before it has finished on the GPU, never blocks
+    bool is_complete(uint64_t batch);
+    void wait(uint64_t batch);
+    void wait_idle();
+
+    /*Submits the acquires of batch and everything before it without waiting for their copies, the GPU
+    orders them. Afterwards other submissions can wait on timeline() reaching batch without the CPU's help.*/
+    void flush(uint64_t batch);
+    VkSemaphore timeline() const { return upload_timeline; }
+
+private:
+    struct Batch
+    {
+        VkCommandBuffer command_buffer;
+        VkCommandBuffer acquire_command_buffer;
+        VkDeviceSize bytes; //including padding skipped when wrapping
+        uint64_t serial;
+        bool reclaim; //acquire submitted by flush() before the copies were done, bytes come back with it
+    };
+
+    void finish_transfer(bool wait);
+    void submit_acquire(const Batch &batch);
+    void finish_acquire(bool wait);
+    VkCommandBuffer begin(VkCommandPool pool, std::vector<VkCommandBuffer> &free_list);
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkQueue acquire_queue = VK_NULL_HANDLE;
+    uint32_t queue_family = 0;
+    uint32_t acquire_family = 0;
+    VkBuffer ring_buffer = VK_NULL_HANDLE;
+    VkCommandPool command_pool = VK_NULL_HANDLE;
+    VkCommandPool acquire_pool = VK_NULL_HANDLE;
+    VkSemaphore upload_timeline = VK_NULL_HANDLE; //serial of the last completed batch
+    VkSemaphore transfer_timeline = VK_NULL_HANDLE; //serial of the last batch whose copies are done, upload_timeline without ownership transfer
+    uint8_t *mapped = nullptr;
+    VkDeviceSize ring_size = 0;
+
+    VkDeviceSize head = 0; //next free byte, the oldest live one is used bytes behind it
+    VkDeviceSize used = 0;
+
+    VkCommandBuffer open_commands = VK_NULL_HANDLE;
+    VkCommandBuffer open_acquire = VK_NULL_HANDLE;
+    VkDeviceSize open_bytes = 0;
+
+    uint64_t submitted = 0; //serial of the last submitted batch
+    uint64_t completed = 0; //serial of the last retired batch
+
+    std::deque<Batch> transferring;
+    std::deque<Batch> acquiring; //always older than everything in transferring
+    std::vector<VkCommandBuffer> free_command_buffers;
+    std::vector<VkCommandBuffer> free_acquire_buffers;
+};
+
+#endif /*STAGING_RING_H*/
@@ -0,0 +1,54 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <vulkan/vulkan.h>
+
+#include "thread_pool.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//bump whenever the encoder's output changes, stale entries are simply never looked up again
+const uint32_t TEXTURE_CACHE_VERSION = 2;
+const std::string TEXTURE_CACHE_DIR = "cache/textures";
+
+/*A texture laid out the way it is copied into the staging buffer: level i starts at
+level_offsets[i] in data. Levels from level_offsets.size() up to mip_levels are left
+for the GPU to blit.*/
+
+struct TextureData
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mip_levels = 1;
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    std::vector<uint8_t> data;
+    std::vector<VkDeviceSize> level_offsets;
+};
+
+//bytes per 4x4 block of the BCn formats we load, 0 for anything else
+uint32_t block_size(VkFormat format);
+
+size_t level_size(VkFormat format, uint32_t width, uint32_t height);
+
+//fills level_offsets for levels packed back to back from the start of data, returns their total size
+VkDeviceSize pack_level_offsets(TextureData &texture, uint32_t level_count);
+
+/*Reads a KTX2 file holding BC1/BC3/BC7 levels (UNORM or SRGB, no supercompression). The whole
+file becomes data and level_offsets point at the levels inside it, so nothing is decoded or
+reordered. Returns false with the reason in err for anything else.*/
+bool load_ktx2(const std::string &path, TextureData &texture, std::string *err);
+
+//writes every level in data as a KTX2 file (levels smallest first, basic data format descriptor)
+bool write_ktx2(const std::string &path, const TextureData &texture);
+
+//KTX2 path under TEXTURE_CACHE_DIR keyed by source path, size, mtime and TEXTURE_CACHE_VERSION, empty if the source is missing
+std::string texture_cache_path(const std::string &source_path);
+
+/*BC1 for opaque rgba8 textures, BC7 as soon as one texel has alpha. All levels in data are encoded,
+split into jobs of a few block rows each on pool.*/
+TextureData compress_bc(const TextureData &rgba, ThreadPool &pool);
+
+#endif /*TEXTURE_H*/
@@ -0,0 +1,105 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency())
+    {
+        thread_count = std::max<size_t>(thread_count, 1);
+
+        for (size_t i = 0; i < thread_count; i++)
+            workers.emplace_back([this] { worker_loop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    template <class F>
+    auto submit(F &&f) -> std::future<decltype(f())>
+    {
+        //packaged_task is move-only, std::function needs something copyable
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+        auto future = task->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([task] { (*task)(); });
+        }
+        cv.notify_one();
+
+        return future;
+    }
+
+    //runs queued tasks while waiting so pool workers can wait on nested jobs without deadlocking
+    template <class T>
+    T wait(std::future<T> &future)
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (tasks.empty())
+                    break; //everything we could depend on is already running
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+
+        return future.get();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void worker_loop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+                if (stopping && tasks.empty())
+                    return;
+
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
+
+#endif /*THREAD_POOL_H*/
@@ -0,0 +1,30 @@
+#ifndef TIMELINE_SEMAPHORE_H
+#define TIMELINE_SEMAPHORE_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+/*VK_KHR_timeline_semaphore on a Vulkan 1.0 device. The entry points aren't exported by the loader,
+so load_timeline_semaphore_functions() looks them up once per device and the proxies below call
+through those pointers, returning VK_ERROR_EXTENSION_NOT_PRESENT until then.*/
+void load_timeline_semaphore_functions(VkDevice device);
+
+VkResult wait_semaphoresKHR( //proxy wait func
+    VkDevice device,
+    const VkSemaphoreWaitInfoKHR *p_wait_info,
+    uint64_t timeout);
+
+VkResult get_semaphore_counter_valueKHR( //proxy query func
+    VkDevice device,
+    VkSemaphore semaphore,
+    uint64_t *p_value);
+
+VkSemaphore create_timeline_semaphore(VkDevice device, uint64_t initial_value);
+
+//current value, never blocks
+uint64_t timeline_value(VkDevice device, VkSemaphore semaphore);
+//blocks until semaphore has reached value
+void wait_timeline(VkDevice device, VkSemaphore semaphore, uint64_t value);
+
+#endif /*TIMELINE_SEMAPHORE_H*/
@@ -0,0 +1,48 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+//per frame, enough for the camera and a few hundred per-draw blocks
+const VkDeviceSize UNIFORM_FRAME_SIZE = 64ull << 10;
+
+/*One persistently mapped uniform buffer split into a region per frame. begin_frame() rewinds the
+frame's region, after which push() copies a block in and returns the offset to bind it at with
+a VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC descriptor, aligned to minUniformBufferOffsetAlignment.
+The caller makes sure the GPU is done with a region before beginning it again.*/
+class UniformRing
+{
+public:
+    UniformRing() = default;
+    ~UniformRing() = default;
+
+    UniformRing(const UniformRing &) = delete;
+    UniformRing &operator=(const UniformRing &) = delete;
+
+    //bytes the buffer needs for frame_count regions
+    static VkDeviceSize buffer_size(uint32_t frame_count, VkDeviceSize alignment);
+
+    //buffer stays owned by the caller, mapped is its host visible and coherent memory
+    void create(VkBuffer buffer, uint8_t *mapped, uint32_t frame_count, VkDeviceSize alignment);
+    void destroy();
+
+    VkBuffer buffer() const { return ring_buffer; }
+    uint32_t frame_offset(uint32_t frame) const { return static_cast<uint32_t>(frame * frame_stride); }
+
+    void begin_frame(uint32_t frame);
+    uint32_t push(const void *data, VkDeviceSize size);
+
+private:
+    VkBuffer ring_buffer = VK_NULL_HANDLE;
+    uint8_t *mapped = nullptr;
+    uint32_t frame_count = 0;
+    VkDeviceSize frame_stride = 0;
+    VkDeviceSize alignment = 1;
+
+    VkDeviceSize frame_begin = 0;
+    VkDeviceSize head = 0; //next free byte of the current frame's region
+};
+
+#endif /*UNIFORM_RING_H*/
@@ -0,0 +1,91 @@
+#ifndef WELD_TABLE_H
+#define WELD_TABLE_H
+
+#include "hash.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*Flat open-addressing map from a value to its index in a caller owned array, used to weld
+duplicate vertices. Slots are 8 bytes (32 bit hash tag + index) probed linearly, the values
+themselves stay in the output array. Equality is bitwise, so T must be free of padding and
+-0.0/0.0 are kept apart.*/
+template <class T>
+class WeldTable
+{
+    static_assert(std::is_trivially_copyable<T>::value, "welded values are hashed and compared as bytes");
+
+public:
+    //expected_count is an upper bound on unique values, e.g. the index count
+    explicit WeldTable(size_t expected_count)
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * expected_count)
+            capacity *= 2;
+
+        slots.assign(capacity, Slot{0, EMPTY});
+    }
+
+    //index of an equal value already in values, otherwise appends value and returns its index
+    uint32_t insert(const T &value, std::vector<T> &values)
+    {
+        uint32_t tag = static_cast<uint32_t>(hash_bytes(&value, sizeof(T)) >> 32);
+        size_t mask = slots.size() - 1;
+
+        for (size_t i = tag & mask;; i = (i + 1) & mask)
+        {
+            Slot &slot = slots[i];
+
+            if (slot.index == EMPTY)
+            {
+                slot = {tag, static_cast<uint32_t>(values.size())};
+                values.push_back(value);
+
+                if (2 * ++count > slots.size())
+                    grow();
+
+                return static_cast<uint32_t>(values.size() - 1);
+            }
+
+            if (slot.tag == tag && memcmp(&values[slot.index], &value, sizeof(T)) == 0)
+                return slot.index;
+        }
+    }
+
+    size_t size() const { return count; }
+
+private:
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t tag;
+        uint32_t index;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    //only reached when expected_count was too small, tags are enough to reinsert
+    void grow()
+    {
+        std::vector<Slot> old_slots(2 * slots.size(), Slot{0, EMPTY});
+        old_slots.swap(slots);
+
+        size_t mask = slots.size() - 1;
+        for (const Slot &slot : old_slots)
+        {
+            if (slot.index == EMPTY)
+                continue;
+
+            size_t i = slot.tag & mask;
+            while (slots[i].index != EMPTY)
+                i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+};
+
+#endif /*WELD_TABLE_H*/
@@ -1,6 +1,6 @@
 #version 450
 
-layout(binding=1)uniform sampler2D txr_sampler;
+layout(set=1,binding=0)uniform sampler2D txr_sampler;
 
 layout(location=0)in vec3 frag_color;
 layout(location=1)in vec2 frag_txr_coord;
@@ -0,0 +1,28 @@
+#version 450
+
+layout(binding=0)uniform UniformBuferObject{
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+}ubo;
+
+//PackedVertex: unorm position within the mesh bounds, dequantized by ubo.model
+layout(location=0)in vec4 in_position;
+layout(location=1)in vec2 in_normal;
+layout(location=2)in vec2 in_txr_coord;
+
+layout(location=0)out vec3 frag_color;
+layout(location=1)out vec2 frag_txr_coord;
+
+vec3 oct_decode(vec2 e){
+    vec3 n=vec3(e,1.-abs(e.x)-abs(e.y));
+    float t=max(-n.z,0.);
+    n.xy+=vec2(n.x>=0.?-t:t,n.y>=0.?-t:t);
+    return normalize(n);
+}
+
+void main(){
+    gl_Position=ubo.proj*ubo.view*ubo.model*vec4(in_position.xyz,1.);
+    frag_color=.5*oct_decode(in_normal)+.5;
+    frag_txr_coord=in_txr_coord;
+}
\ No newline at end of file
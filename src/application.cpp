@@ -1,4 +1,7 @@
 #include "application.h"
+#include "obj_parser.h"
+#include "hash.h"
+#include "bc_encoder.h"
 
 VkResult create_debug_utils_messengerEXT(
     VkInstance instance,
@@ -27,6 +30,8 @@ void destroy_debug_utils_messengerEXT(
 
 void Application::run()
 {
+    t_startup = std::chrono::high_resolution_clock::now();
+
     init_window();
     init_vulkan();
     main_loop();
@@ -56,45 +61,158 @@ void Application::init_vulkan()
     create_surface();
     pick_physical_device();
     create_logical_device();
+    gpu_allocator.create(physical_device, device);
+    create_pipeline_cache();
     create_swap_chain();
     create_image_views();
     create_render_pass();
     create_descriptor_layout();
-    create_graphics_pipeline();
-    create_command_pool();
+    create_pipeline_layout();
+    create_pipeline_registry();
+    create_command_pools();
+    create_staging_ring();
     create_depth_resources();
     create_framebuffers();
-    create_texture_image();
-    create_texture_image_view();
     create_texture_sampler();
-    load_model();
-    create_vertex_buffer();
-    create_index_buffer();
-    create_uniform_buffers();
+    create_placeholder_texture();
+
+    if (use_background_loading)
+    {
+        model_load = thread_pool.submit([this] {
+            load_model();
+            compute_mesh_sphere();
+        });
+    }
+    else
+    {
+        load_model();
+        compute_mesh_sphere();
+        upload_model();
+    }
+
+    create_uniform_ring();
+    create_indirect_buffers();
     create_descriptor_pool();
-    create_descriptor_sets();
+    create_descriptor_set();
     create_command_buffers();
     create_sync_objects();
 }
 
 void Application::load_model()
 {
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    MeshCacheSection vertex_section = use_packed_vertices ? MeshCacheSection::packed_vertices : MeshCacheSection::vertices;
+    MeshCacheSection index_section = use_16bit_indices ? MeshCacheSection::indices16 : MeshCacheSection::indices;
+    size_t vertex_stride = use_packed_vertices ? sizeof(PackedVertex) : sizeof(Vertex);
+    size_t index_size = use_16bit_indices ? sizeof(uint16_t) : sizeof(uint32_t);
+
+    //every setting that changes what the cold path stores, a blob written under other settings is rebuilt
+    std::stringstream settings;
+    settings << use_mesh_optimizer << use_packed_vertices << use_16bit_indices << use_meshlet_culling << use_lod_chain
+             << use_material_sorting << " " << MAX_SUBMESH_VERTICES << " " << MESHLET_MAX_VERTICES << " "
+             << MESHLET_MAX_TRIANGLES << " " << MAX_LOD_COUNT << " " << TEXTURE_PATH;
+    std::string settings_key = settings.str();
+    uint64_t config = hash_bytes(settings_key.data(), settings_key.size());
+
+    if (use_mesh_cache && mesh_cache.open(MODEL_PATH, config) &&
+        mesh_cache.has(vertex_section) && mesh_cache.has(index_section) && mesh_cache.has(MeshCacheSection::submeshes) &&
+        mesh_cache.has(MeshCacheSection::materials) &&
+        (!use_packed_vertices || mesh_cache.size(MeshCacheSection::bounds) == sizeof(MeshBounds)) &&
+        (!use_meshlet_culling || (mesh_cache.has(MeshCacheSection::meshlets) && mesh_cache.has(MeshCacheSection::lods) &&
+                                  mesh_cache.has(MeshCacheSection::draw_ranges))))
+    {
+        vertex_count = static_cast<uint32_t>(mesh_cache.size(vertex_section) / vertex_stride);
+        index_count = static_cast<uint32_t>(mesh_cache.size(index_section) / index_size);
+
+        const Submesh *cached_submeshes = static_cast<const Submesh *>(mesh_cache.data(MeshCacheSection::submeshes));
+        submeshes.assign(cached_submeshes, cached_submeshes + mesh_cache.count<Submesh>(MeshCacheSection::submeshes));
+
+        //texture paths, each one null terminated
+        const char *paths = static_cast<const char *>(mesh_cache.data(MeshCacheSection::materials));
+        for (const char *path = paths; path < paths + mesh_cache.size(MeshCacheSection::materials); path += strlen(path) + 1)
+            material_textures.push_back(path);
+
+        if (use_packed_vertices)
+            memcpy(&mesh_bounds, mesh_cache.data(MeshCacheSection::bounds), sizeof(MeshBounds));
+
+        if (use_meshlet_culling)
+        {
+            const Meshlet *cached_meshlets = static_cast<const Meshlet *>(mesh_cache.data(MeshCacheSection::meshlets));
+            meshlets.assign(cached_meshlets, cached_meshlets + mesh_cache.count<Meshlet>(MeshCacheSection::meshlets));
+
+            const MeshLod *cached_lods = static_cast<const MeshLod *>(mesh_cache.data(MeshCacheSection::lods));
+            lods.assign(cached_lods, cached_lods + mesh_cache.count<MeshLod>(MeshCacheSection::lods));
+
+            const DrawRange *cached_ranges = static_cast<const DrawRange *>(mesh_cache.data(MeshCacheSection::draw_ranges));
+            draw_ranges.assign(cached_ranges, cached_ranges + mesh_cache.count<DrawRange>(MeshCacheSection::draw_ranges));
+        }
+
+        float t_load = std::chrono::duration<float, std::chrono::seconds::period>(
+                           std::chrono::high_resolution_clock::now() - t_start)
+                           .count();
+        std::cout << "load_model (warm, mesh cache): " << 1000.0f * t_load << " ms" << std::endl;
+        return;
+    }
+    mesh_cache.close();
+
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
     std::string warn, err;
+    std::string model_dir = MODEL_PATH.substr(0, MODEL_PATH.find_last_of('/') + 1);
+
+    /*stamped before parsing, so a save during the load leaves a blob that is already stale. Texture
+    paths come out of the .mtl files, so those are stamped along with the source*/
+    MeshCacheStamp cache_stamp;
+    bool stamped = use_mesh_cache &&
+                   MeshCache::stamp(MODEL_PATH, find_material_libraries(MODEL_PATH.c_str(), model_dir.c_str()), cache_stamp);
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str()))
+    bool loaded = use_parallel_obj_parser
+                      ? load_obj_parallel(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str(), thread_pool, model_dir.c_str())
+                      : tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str(), model_dir.c_str());
+
+    if (!loaded)
     {
         throw std::runtime_error(warn + err);
     }
 
+    float t_parse = std::chrono::duration<float, std::chrono::seconds::period>(
+                        std::chrono::high_resolution_clock::now() - t_start)
+                        .count();
+    float file_mb = std::ifstream(MODEL_PATH, std::ios::ate | std::ios::binary).tellg() / (1024.0f * 1024.0f);
+
+    std::cout << (use_parallel_obj_parser ? "parallel obj parser (" + std::to_string(thread_pool.size()) + " threads)" : "tinyobj")
+              << ": " << file_mb << " MB in " << 1000.0f * t_parse << " ms  |  " << file_mb / t_parse << " MB/s" << std::endl;
+
+    auto t_weld_start = std::chrono::high_resolution_clock::now();
+
+    size_t total_indices = 0;
+    for (const auto &shape : shapes)
+        total_indices += shape.mesh.indices.size();
+
+    indices.reserve(total_indices);
+
+    std::vector<uint32_t> material_texture = load_materials(materials);
+    std::vector<uint32_t> triangle_materials;
+    triangle_materials.reserve(total_indices / 3);
+
+    WeldTable<Vertex> weld_table(use_weld_table ? total_indices : 0);
     std::unordered_map<Vertex, uint32_t> unique_vertices{};
 
     for (const auto &shape : shapes)
     {
-        for (const auto &index : shape.mesh.indices)
+        for (size_t i = 0; i < shape.mesh.indices.size(); i++)
         {
+            const auto &index = shape.mesh.indices[i];
+
+            //faces without a material (id -1) take the texture of the extra last entry
+            if (i % 3 == 0)
+            {
+                int material = i / 3 < shape.mesh.material_ids.size() ? shape.mesh.material_ids[i / 3] : -1;
+                triangle_materials.push_back(material >= 0 ? material_texture[material] : material_texture.back());
+            }
+
             Vertex vertex{};
 
             vertex.pos = {
@@ -111,6 +229,12 @@ void Application::load_model()
                 0.5 * attrib.normals[3 * index.vertex_index + 1] + 0.5,
                 0.5 * attrib.normals[3 * index.vertex_index + 2] + 0.5};
 
+            if (use_weld_table)
+            {
+                indices.push_back(weld_table.insert(vertex, vertices));
+                continue;
+            }
+
             if (unique_vertices.count(vertex) == 0)
             {
                 unique_vertices[vertex] = static_cast<uint32_t>(vertices.size());
@@ -120,6 +244,458 @@ void Application::load_model()
             indices.push_back(unique_vertices[vertex]);
         }
     }
+
+    float t_weld = std::chrono::duration<float, std::chrono::seconds::period>(
+                       std::chrono::high_resolution_clock::now() - t_weld_start)
+                       .count();
+    std::cout << (use_weld_table ? "weld table" : "unordered_map") << ": " << indices.size() << " indices -> "
+              << vertices.size() << " vertices in " << 1000.0f * t_weld << " ms  |  "
+              << indices.size() / t_weld / 1e6f << " M indices/s" << std::endl;
+
+    group_by_material(triangle_materials);
+
+    if (use_mesh_optimizer)
+        optimize_mesh();
+
+    if (use_16bit_indices)
+        build_submeshes();
+
+    std::vector<std::vector<Submesh>> lod_submeshes = {submeshes};
+
+    if (use_lod_chain)
+        build_lods(lod_submeshes);
+
+    if (use_meshlet_culling)
+        build_meshlets(lod_submeshes);
+
+    if (use_packed_vertices)
+        pack_vertices();
+
+    vertex_count = static_cast<uint32_t>(vertices.size());
+    index_count = static_cast<uint32_t>(indices.size());
+
+    std::string material_blob;
+    for (const auto &path : material_textures)
+        material_blob.append(path.c_str(), path.size() + 1);
+
+    std::vector<MeshCacheBlob> blobs = {{MeshCacheSection::submeshes, submeshes.data(), sizeof(Submesh) * submeshes.size()},
+                                        {MeshCacheSection::materials, material_blob.data(), material_blob.size()}};
+
+    if (use_meshlet_culling)
+    {
+        blobs.push_back({MeshCacheSection::meshlets, meshlets.data(), sizeof(Meshlet) * meshlets.size()});
+        blobs.push_back({MeshCacheSection::lods, lods.data(), sizeof(MeshLod) * lods.size()});
+        blobs.push_back({MeshCacheSection::draw_ranges, draw_ranges.data(), sizeof(DrawRange) * draw_ranges.size()});
+    }
+
+    if (use_16bit_indices)
+        blobs.push_back({MeshCacheSection::indices16, indices16.data(), sizeof(uint16_t) * indices16.size()});
+    else
+        blobs.push_back({MeshCacheSection::indices, indices.data(), sizeof(uint32_t) * indices.size()});
+
+    if (use_packed_vertices)
+    {
+        blobs.push_back({MeshCacheSection::packed_vertices, packed_vertices.data(), sizeof(PackedVertex) * packed_vertices.size()});
+        blobs.push_back({MeshCacheSection::bounds, &mesh_bounds, sizeof(MeshBounds)});
+    }
+    else
+        blobs.push_back({MeshCacheSection::vertices, vertices.data(), sizeof(Vertex) * vertices.size()});
+
+    if (use_mesh_cache && (!stamped || !MeshCache::store(MODEL_PATH, config, cache_stamp, blobs)))
+        std::cerr << "failed to write mesh cache for " << MODEL_PATH << std::endl;
+
+    float t_load = std::chrono::duration<float, std::chrono::seconds::period>(
+                       std::chrono::high_resolution_clock::now() - t_start)
+                       .count();
+    std::cout << "load_model (cold): " << 1000.0f * t_load << " ms" << std::endl;
+}
+
+//texture index for every tinyobj material plus one more for faces without a material
+std::vector<uint32_t> Application::load_materials(const std::vector<tinyobj::material_t> &materials)
+{
+    std::string model_dir = MODEL_PATH.substr(0, MODEL_PATH.find_last_of('/') + 1);
+    std::unordered_map<std::string, uint32_t> texture_ids;
+    std::vector<uint32_t> material_texture;
+
+    //materials sharing a diffuse texture share its descriptor set
+    auto texture_id = [&](const std::string &path) {
+        auto inserted = texture_ids.emplace(path, static_cast<uint32_t>(material_textures.size()));
+        if (inserted.second)
+            material_textures.push_back(path);
+        return inserted.first->second;
+    };
+
+    for (const auto &material : materials)
+    {
+        std::string path = material.diffuse_texname;
+        std::replace(path.begin(), path.end(), '\\', '/');
+        material_texture.push_back(texture_id(path.empty() ? TEXTURE_PATH : model_dir + path));
+    }
+    material_texture.push_back(texture_id(TEXTURE_PATH));
+
+    return material_texture;
+}
+
+/*Turns the per triangle material into contiguous index ranges, stored in submeshes. Sorting is a
+stable counting sort so triangles keep their file order within a material; without it every run of
+equal materials in file order becomes its own range.*/
+void Application::group_by_material(const std::vector<uint32_t> &triangle_materials)
+{
+    size_t triangle_count = indices.size() / 3;
+    std::vector<uint32_t> sorted_materials = triangle_materials;
+
+    if (use_material_sorting)
+    {
+        std::vector<uint32_t> first(material_textures.size() + 1, 0);
+        for (uint32_t material : triangle_materials)
+            first[material + 1]++;
+        for (size_t m = 1; m < first.size(); m++)
+            first[m] += first[m - 1];
+
+        std::vector<uint32_t> sorted(indices.size());
+        for (size_t t = 0; t < triangle_count; t++)
+        {
+            uint32_t destination = first[triangle_materials[t]]++;
+            memcpy(&sorted[3 * destination], &indices[3 * t], 3 * sizeof(uint32_t));
+            sorted_materials[destination] = triangle_materials[t];
+        }
+        indices.swap(sorted);
+    }
+
+    submeshes.clear();
+    for (size_t t = 0; t < triangle_count; t++)
+    {
+        if (submeshes.empty() || submeshes.back().material != sorted_materials[t])
+            submeshes.push_back({static_cast<uint32_t>(3 * t), 0, 0, sorted_materials[t]});
+        submeshes.back().index_count += 3;
+    }
+
+    std::cout << "materials: " << material_textures.size() << " textures, " << submeshes.size() << " index ranges"
+              << (use_material_sorting ? " (sorted)" : " (file order)") << std::endl;
+}
+
+void Application::optimize_mesh()
+{
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    VertexCacheStatistics before = analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+
+    //triangles only move within their material range
+    for (const auto &submesh : submeshes)
+        optimize_vertex_cache(&indices[submesh.first_index], submesh.index_count);
+    vertices.resize(optimize_vertex_fetch(vertices.data(), vertices.size(), sizeof(Vertex), indices.data(), indices.size()));
+
+    VertexCacheStatistics after = analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+
+    float t_optimize = std::chrono::duration<float, std::chrono::seconds::period>(
+                           std::chrono::high_resolution_clock::now() - t_start)
+                           .count();
+    std::cout << "mesh optimizer (fifo " << VERTEX_CACHE_ANALYSIS_SIZE << "): ACMR " << before.acmr << " -> " << after.acmr
+              << "  |  ATVR " << before.atvr << " -> " << after.atvr << "  |  " << 1000.0f * t_optimize << " ms" << std::endl;
+}
+
+void Application::build_submeshes()
+{
+    std::vector<uint32_t> vertex_remap;
+    submeshes = split_submeshes(indices.data(), submeshes, vertices.size(), indices16, vertex_remap);
+
+    std::vector<Vertex> split_vertices(vertex_remap.size());
+    for (size_t i = 0; i < vertex_remap.size(); i++)
+        split_vertices[i] = vertices[vertex_remap[i]];
+
+    //keep the 32 bit indices valid for the split vertex order
+    for (const auto &submesh : submeshes)
+    {
+        for (uint32_t i = submesh.first_index; i < submesh.first_index + submesh.index_count; i++)
+            indices[i] = submesh.vertex_offset + indices16[i];
+    }
+
+    std::cout << "16 bit indices: " << submeshes.size() << " submeshes, " << split_vertices.size() - vertices.size()
+              << " duplicated vertices, index buffer " << sizeof(uint32_t) * indices.size() / (1024.0f * 1024.0f) << " MB -> "
+              << sizeof(uint16_t) * indices16.size() / (1024.0f * 1024.0f) << " MB" << std::endl;
+
+    vertices.swap(split_vertices);
+}
+
+/*Every LOD simplifies the previous one to half its triangles, submesh by submesh so the 16 bit
+ranges keep their base vertex. New indices are appended behind LOD 0 in the same buffers.*/
+void Application::build_lods(std::vector<std::vector<Submesh>> &lod_submeshes)
+{
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    lods = {{0, 0, static_cast<uint32_t>(indices.size() / 3), 0.0f}};
+
+    std::vector<uint32_t> simplified;
+    std::vector<uint32_t> level_indices;
+
+    while (lod_submeshes.size() < MAX_LOD_COUNT)
+    {
+        const std::vector<Submesh> &previous = lod_submeshes.back();
+        std::vector<Submesh> level;
+        float level_error = 0.0f;
+
+        level_indices.clear();
+        for (const auto &submesh : previous)
+        {
+            float error;
+            simplified.resize(submesh.index_count);
+            size_t count = simplify_mesh(simplified.data(), &indices[submesh.first_index], submesh.index_count,
+                                         &vertices[0].pos.x, sizeof(Vertex), submesh.index_count / 2, &error);
+
+            if (use_mesh_optimizer)
+                optimize_vertex_cache(simplified.data(), count);
+
+            level.push_back({static_cast<uint32_t>(indices.size() + level_indices.size()), static_cast<uint32_t>(count), submesh.vertex_offset, submesh.material});
+            level_indices.insert(level_indices.end(), simplified.begin(), simplified.begin() + count);
+            level_error = std::max(level_error, error);
+        }
+
+        //locked borders and seams eventually leave nothing worth a level
+        if (level_indices.size() / 3 > 0.9f * lods.back().triangle_count)
+            break;
+
+        for (const auto &submesh : level)
+        {
+            for (uint32_t i = 0; use_16bit_indices && i < submesh.index_count; i++)
+            {
+                uint32_t index = level_indices[submesh.first_index - indices.size() + i];
+                indices16.push_back(static_cast<uint16_t>(index - submesh.vertex_offset));
+            }
+        }
+
+        indices.insert(indices.end(), level_indices.begin(), level_indices.end());
+        lods.push_back({0, 0, static_cast<uint32_t>(level_indices.size() / 3), lods.back().error + level_error});
+        lod_submeshes.push_back(level);
+    }
+
+    float t_build = std::chrono::duration<float, std::chrono::seconds::period>(
+                        std::chrono::high_resolution_clock::now() - t_start)
+                        .count();
+    std::cout << "lod chain (" << 1000.0f * t_build << " ms):";
+    for (const auto &lod : lods)
+        std::cout << "  " << lod.triangle_count << " tris @ " << lod.error;
+    std::cout << std::endl;
+}
+
+void Application::build_meshlets(const std::vector<std::vector<Submesh>> &lod_submeshes)
+{
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    lods.resize(lod_submeshes.size(), {0, 0, static_cast<uint32_t>(indices.size() / 3), 0.0f});
+
+    for (size_t level = 0; level < lod_submeshes.size(); level++)
+    {
+        const std::vector<Submesh> &level_submeshes = lod_submeshes[level];
+        lods[level].first_meshlet = static_cast<uint32_t>(meshlets.size());
+
+        //one draw range per run of submeshes with the same material
+        for (size_t begin = 0, end = 0; begin < level_submeshes.size(); begin = end)
+        {
+            while (end < level_submeshes.size() && level_submeshes[end].material == level_submeshes[begin].material)
+                end++;
+
+            std::vector<Submesh> run(level_submeshes.begin() + begin, level_submeshes.begin() + end);
+            std::vector<Meshlet> run_meshlets = ::build_meshlets(indices.data(), run, &vertices[0].pos.x, sizeof(Vertex), vertices.size());
+
+            draw_ranges.push_back({run[0].material, static_cast<uint32_t>(level), static_cast<uint32_t>(meshlets.size()),
+                                   static_cast<uint32_t>(run_meshlets.size())});
+            meshlets.insert(meshlets.end(), run_meshlets.begin(), run_meshlets.end());
+        }
+
+        lods[level].meshlet_count = static_cast<uint32_t>(meshlets.size()) - lods[level].first_meshlet;
+    }
+
+    //LODs of one material next to each other, the material set is bound once for all of them
+    if (use_material_sorting)
+    {
+        std::stable_sort(draw_ranges.begin(), draw_ranges.end(), [](const DrawRange &a, const DrawRange &b) {
+            return a.material < b.material;
+        });
+    }
+
+    float t_build = std::chrono::duration<float, std::chrono::seconds::period>(
+                        std::chrono::high_resolution_clock::now() - t_start)
+                        .count();
+    std::cout << "meshlets: " << meshlets.size() << " over " << lods.size() << " lods (max " << MESHLET_MAX_VERTICES << " vertices, "
+              << MESHLET_MAX_TRIANGLES << " triangles) in " << 1000.0f * t_build << " ms" << std::endl;
+}
+
+void Application::compute_mesh_sphere()
+{
+    if (lods.empty())
+        return;
+
+    glm::vec3 lo(INFINITY), hi(-INFINITY);
+    for (uint32_t i = lods[0].first_meshlet; i < lods[0].first_meshlet + lods[0].meshlet_count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            lo[k] = std::min(lo[k], meshlets[i].center[k] - meshlets[i].radius);
+            hi[k] = std::max(hi[k], meshlets[i].center[k] + meshlets[i].radius);
+        }
+    }
+
+    mesh_center = 0.5f * (lo + hi);
+    mesh_radius = 0.0f;
+    for (uint32_t i = lods[0].first_meshlet; i < lods[0].first_meshlet + lods[0].meshlet_count; i++)
+    {
+        glm::vec3 center(meshlets[i].center[0], meshlets[i].center[1], meshlets[i].center[2]);
+        mesh_radius = std::max(mesh_radius, glm::length(center - mesh_center) + meshlets[i].radius);
+    }
+}
+
+void Application::pack_vertices()
+{
+    glm::vec3 lo = vertices.empty() ? glm::vec3(0.0f) : vertices[0].pos;
+    glm::vec3 hi = lo;
+
+    for (const auto &vertex : vertices)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            lo[i] = std::min(lo[i], vertex.pos[i]);
+            hi[i] = std::max(hi[i], vertex.pos[i]);
+        }
+    }
+
+    mesh_bounds.min = lo;
+    for (int i = 0; i < 3; i++)
+        mesh_bounds.extent[i] = hi[i] > lo[i] ? hi[i] - lo[i] : 1.0f;
+
+    packed_vertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+        packed_vertices[i] = PackedVertex::pack(vertices[i], mesh_bounds);
+
+    std::cout << "packed vertices: " << sizeof(Vertex) * vertices.size() / (1024.0f * 1024.0f) << " MB -> "
+              << sizeof(PackedVertex) * packed_vertices.size() / (1024.0f * 1024.0f) << " MB" << std::endl;
+}
+
+//everything load_model left on the CPU goes to the GPU here, textures follow as they decode
+void Application::upload_model()
+{
+    upload_geometry();
+    mesh_cache.close(); //already copied into the staging ring
+
+    texture_images.assign(material_textures.size(), VK_NULL_HANDLE);
+    texture_images_memory.assign(material_textures.size(), GpuAllocation{});
+    texture_image_views.assign(material_textures.size(), VK_NULL_HANDLE);
+    create_material_descriptor_sets();
+
+    for (size_t i = 0; i < material_textures.size(); i++)
+    {
+        if (use_background_loading)
+            texture_loads.push_back(thread_pool.submit([path = material_textures[i], cpu_mipmaps = !blit_mipmaps, bc = bc_textures, this] {
+                return load_texture(path, cpu_mipmaps, bc, thread_pool);
+            }));
+        else
+            upload_texture(i, load_texture(material_textures[i], !blit_mipmaps, bc_textures, thread_pool));
+    }
+    texture_loads_pending = texture_loads.size();
+
+    /*mesh and any synchronous textures in one submission, which the next frame waits for on the GPU
+    instead of the CPU waiting here. With a transfer queue that frame flushes the acquire out first*/
+    upload_dependency = staging_ring.submit();
+
+    if (!use_background_loading)
+    {
+        for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+            for (size_t i = 0; i < material_textures.size(); i++)
+                write_material_descriptor(frame, i, texture_image_views[i]);
+    }
+
+    mesh_ready = true;
+}
+
+/*Picks up finished background loads. Texture copies never wait: they are recorded, submitted and
+swapped in frames later when their staging batch has completed, so with a transfer queue they overlap
+rendering. Frames in flight may still have the material sets bound, so a swap is only queued for each
+frame's copy of the sets, and draw_frame writes it once that frame's previous use has retired.*/
+void Application::poll_loads()
+{
+    auto ready = [](std::future<TextureData> &future) {
+        return future.valid() && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
+
+    if (model_load.valid() && model_load.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        model_load.get(); //rethrows load_model errors on the main thread
+
+        /*no need to idle the device: frames before this one recorded no draws, and the mesh lands in a new
+        arena with new material sets and indirect buffers, so nothing in flight is replaced or rewritten*/
+        upload_model();
+        create_indirect_buffers();
+
+        std::cout << "startup: mesh uploaded after " << startup_ms() << " ms" << std::endl;
+        return;
+    }
+
+    //batches complete in submission order, so do the swaps
+    bool swapped = false;
+    while (!texture_swaps.empty() && staging_ring.is_complete(texture_swaps.front().second))
+    {
+        swapped = true;
+
+        for (std::vector<size_t> &writes : material_writes)
+            writes.push_back(texture_swaps.front().first);
+        texture_swaps.pop_front();
+    }
+
+    uint32_t uploads = 0;
+    for (size_t i = 0; i < texture_loads.size() && uploads < MAX_TEXTURE_UPLOADS_PER_FRAME; i++)
+    {
+        if (!ready(texture_loads[i]))
+            continue;
+
+        upload_texture(i, texture_loads[i].get());
+        texture_swaps.push_back({i, 0});
+        texture_loads_pending--;
+        uploads++;
+    }
+
+    //one submission for the whole batch of textures
+    if (uploads != 0)
+    {
+        uint64_t batch = staging_ring.submit();
+        for (size_t i = texture_swaps.size() - uploads; i < texture_swaps.size(); i++)
+            texture_swaps[i].second = batch;
+    }
+
+    if (!swapped)
+        return;
+
+    if (texture_loads_pending == 0 && texture_swaps.empty())
+    {
+        std::cout << "startup: " << texture_loads.size() << " textures resident after " << startup_ms() << " ms" << std::endl;
+        std::cout << gpu_allocator.stats() << std::endl;
+        report_upload_frame_times();
+    }
+}
+
+//frame time percentiles over the background texture upload, run once with use_transfer_queue off to compare
+void Application::report_upload_frame_times()
+{
+    if (upload_frame_times.empty())
+        return;
+
+    std::vector<float> times = upload_frame_times;
+    std::sort(times.begin(), times.end());
+
+    auto percentile = [&](float p) {
+        return times[std::min(times.size() - 1, static_cast<size_t>(p * times.size()))];
+    };
+
+    std::cout << "frame times during texture upload (" << (staging_ring.ownership_transfer() ? "transfer queue" : "graphics queue")
+              << ", " << times.size() << " frames): p50 " << percentile(0.5f) << " ms, p95 " << percentile(0.95f)
+              << " ms, p99 " << percentile(0.99f) << " ms, max " << times.back() << " ms" << std::endl;
+
+    upload_frame_times.clear();
+}
+
+float Application::startup_ms() const
+{
+    return std::chrono::duration<float, std::chrono::milliseconds::period>(
+               std::chrono::high_resolution_clock::now() - t_startup)
+        .count();
 }
 
 void Application::process_input()
@@ -157,9 +733,18 @@ void Application::process_timing(bool show_fps)
     if (t_current_frame - t_last_monitor >= 1.0f)
     {
         std::stringstream ss;
-        ss << 1000.0f * delta << " ms  |  " << 1.0f / delta << " fps";
+        ss << 1000.0f * delta << " ms  |  " << 1.0f / delta << " fps  |  "
+           << blocked_ms_sum / std::max<uint32_t>(blocked_frames, 1) << " ms blocked";
+        if (use_meshlet_culling)
+            ss << "  |  " << triangles_submitted << " tris drawn, " << triangles_culled << " culled ("
+               << 100.0f * triangles_culled / std::max<uint64_t>(triangles_submitted + triangles_culled, 1) << "%)";
+        ss << "  |  " << descriptor_binds << " binds, " << draw_calls << " draws, recorded in " << record_ms << " ms";
+        if (use_lod_chain)
+            ss << "  |  LOD " << current_lod << " (" << lod_policy_name(lod_policy) << ")";
         glfwSetWindowTitle(window, ss.str().c_str());
         t_last_monitor = t_current_frame;
+        blocked_ms_sum = 0.0f;
+        blocked_frames = 0;
     }
 }
 
@@ -170,8 +755,25 @@ void Application::main_loop()
         glfwPollEvents();
         process_input();
 
+        if (use_background_loading)
+            poll_loads();
+        if (use_shader_hot_reload)
+            poll_shaders();
+
         draw_frame();
         process_timing(true);
+
+        if (texture_loads_pending != 0 || !texture_swaps.empty())
+            upload_frame_times.push_back(1000.0f * delta);
+
+        if (first_frame)
+        {
+            std::cout << "startup: first frame after " << startup_ms() << " ms" << std::endl;
+            first_frame = false;
+        }
+
+        if (lod_sweep.active)
+            step_lod_sweep();
     }
 
     vkDeviceWaitIdle(device);
@@ -179,28 +781,81 @@ void Application::main_loop()
 
 void Application::cleanup()
 {
-    clean_swap_chain();
+    //workers still write into members, let them finish before anything goes away
+    if (model_load.valid())
+        model_load.wait();
+    for (auto &texture_load : texture_loads)
+    {
+        if (texture_load.valid())
+            texture_load.wait();
+    }
+    if (shader_compile.valid())
+        shader_compile.wait();
+    shader_watcher.close();
+
+    retire_swap_chain();
+    destroy_retired_swap_chains(UINT64_MAX);
 
+    destroy_retired_pipelines(UINT64_MAX);
+    pipelines.destroy();
+    vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+    vkDestroyRenderPass(device, render_pass, nullptr);
+
+    if (use_pipeline_cache && !store_pipeline_cache(device, pipeline_cache))
+        std::cout << "failed to write " << PIPELINE_CACHE_PATH << std::endl;
+    vkDestroyPipelineCache(device, pipeline_cache, nullptr);
+
+    uniform_ring.destroy();
+    vkDestroyBuffer(device, uniform_buffer, nullptr);
+    gpu_allocator.free(uniform_buffer_memory);
+
+    for (size_t i = 0; i < indirect_buffers.size(); i++)
+    {
+        vkDestroyBuffer(device, indirect_buffers[i], nullptr);
+        gpu_allocator.free(indirect_buffers_memory[i]);
+    }
+    indirect_buffers.clear();
+    indirect_buffers_memory.clear();
+
+    vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+    vkDestroyDescriptorPool(device, material_descriptor_pool, nullptr);
     vkDestroySampler(device, texture_sampler, nullptr);
-    vkDestroyImageView(device, texture_image_view, nullptr);
-    vkDestroyImage(device, texture_image, nullptr);
-    vkFreeMemory(device, texture_image_memory, nullptr);
+    for (size_t i = 0; i < texture_images.size(); i++)
+    {
+        vkDestroyImageView(device, texture_image_views[i], nullptr);
+        vkDestroyImage(device, texture_images[i], nullptr);
+        gpu_allocator.free(texture_images_memory[i]);
+    }
+    vkDestroyImageView(device, placeholder_image_view, nullptr);
+    vkDestroyImage(device, placeholder_image, nullptr);
+    gpu_allocator.free(placeholder_image_memory);
 
+    vkDestroyDescriptorSetLayout(device, material_set_layout, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptor_set_layout, nullptr);
 
-    vkDestroyBuffer(device, index_buffer, nullptr);
-    vkFreeMemory(device, index_buffer_memory, nullptr);
-    vkDestroyBuffer(device, vertex_buffer, nullptr);
-    vkFreeMemory(device, vertex_buffer_memory, nullptr);
+    geometry_arena.free(mesh_geometry);
+    geometry_arena.destroy();
+    vkDestroyBuffer(device, geometry_buffer, nullptr);
+    gpu_allocator.free(geometry_buffer_memory);
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         vkDestroySemaphore(device, render_finished_semaphores[i], nullptr);
         vkDestroySemaphore(device, image_available_semaphores[i], nullptr);
-        vkDestroyFence(device, in_flight_fences[i], nullptr);
     }
+    vkDestroySemaphore(device, frame_timeline, nullptr);
 
-    vkDestroyCommandPool(device, command_pool, nullptr);
+    staging_ring.destroy();
+    vkDestroyBuffer(device, staging_buffer, nullptr);
+    gpu_allocator.free(staging_buffer_memory);
+    //destroying the pools frees the command buffers allocated from them
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+    {
+        vkDestroyCommandPool(device, command_pools[frame], nullptr);
+        for (VkCommandPool pool : record_command_pools[frame])
+            vkDestroyCommandPool(device, pool, nullptr);
+    }
+    gpu_allocator.destroy();
     vkDestroyDevice(device, nullptr);
 
     if (enable_validation_layers)
@@ -213,35 +868,47 @@ void Application::cleanup()
     glfwTerminate();
 }
 
-void Application::clean_swap_chain()
+//tagged a few frames past the last submitted one, by then the presentation engine has let go of its images too
+void Application::retire_swap_chain()
 {
-    vkDestroyImageView(device, depth_image_view, nullptr);
-    vkDestroyImage(device, depth_image, nullptr);
-    vkFreeMemory(device, depth_image_memory, nullptr);
-
-    for (auto framebuffer : swap_chain_framebuffers)
-        vkDestroyFramebuffer(device, framebuffer, nullptr);
+    RetiredSwapChain retired{};
+    retired.frame = frame_number + MAX_FRAMES_IN_FLIGHT;
+    retired.swap_chain = swap_chain;
+    retired.image_views = std::move(swap_chain_image_views);
+    retired.framebuffers = std::move(swap_chain_framebuffers);
+    retired.depth_image = depth_image;
+    retired.depth_image_memory = depth_image_memory;
+    retired.depth_image_view = depth_image_view;
+    retired_swap_chains.push_back(std::move(retired));
+
+    swap_chain_image_views.clear();
+    swap_chain_framebuffers.clear();
+}
 
-    vkFreeCommandBuffers(device, command_pool, static_cast<uint32_t>(command_buffers.size()), command_buffers.data());
+void Application::destroy_retired_swap_chains(uint64_t completed_frame)
+{
+    while (!retired_swap_chains.empty() && retired_swap_chains.front().frame <= completed_frame)
+    {
+        RetiredSwapChain &retired = retired_swap_chains.front();
 
-    vkDestroyPipeline(device, graphics_pipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
-    vkDestroyRenderPass(device, render_pass, nullptr);
+        vkDestroyImageView(device, retired.depth_image_view, nullptr);
+        vkDestroyImage(device, retired.depth_image, nullptr);
+        gpu_allocator.free(retired.depth_image_memory);
 
-    for (auto image_view : swap_chain_image_views)
-        vkDestroyImageView(device, image_view, nullptr);
+        for (auto framebuffer : retired.framebuffers)
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        for (auto image_view : retired.image_views)
+            vkDestroyImageView(device, image_view, nullptr);
 
-    vkDestroySwapchainKHR(device, swap_chain, nullptr);
+        vkDestroySwapchainKHR(device, retired.swap_chain, nullptr);
 
-    for (size_t i = 0; i < swap_chain_images.size(); i++)
-    {
-        vkDestroyBuffer(device, uniform_buffers[i], nullptr);
-        vkFreeMemory(device, uniform_buffers_memory[i], nullptr);
+        retired_swap_chains.pop_front();
     }
-
-    vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
 }
 
+/*Only what depends on the window size is rebuilt: the viewport and scissor are dynamic state, so the
+render pass and pipeline survive unless the surface format changes with the resize. Frames still in
+flight keep using the old objects, they're retired instead of destroyed and nothing waits for the device.*/
 void Application::recreate_swap_chain()
 {
     int width = 0, height = 0;
@@ -252,20 +919,33 @@ void Application::recreate_swap_chain()
         glfwWaitEvents();
     }
 
-    vkDeviceWaitIdle(device);
+    auto t_start = std::chrono::high_resolution_clock::now();
 
-    clean_swap_chain();
+    VkFormat old_format = swap_chain_image_format;
+    retire_swap_chain();
 
-    create_swap_chain();
+    create_swap_chain(); //hands the retired one over as oldSwapchain
     create_image_views();
-    create_render_pass();
-    create_graphics_pipeline();
+
+    if (swap_chain_image_format != old_format)
+    {
+        //rare enough that waiting for the last submitted frame is fine
+        wait_timeline(device, frame_timeline, frame_number);
+        vkDestroyRenderPass(device, render_pass, nullptr);
+
+        create_render_pass();
+        PipelineKey fallback = pipelines.key(opaque_pipeline);
+        pipelines.set_render_pass(render_pass, pipeline_layout, fallback);
+    }
+
     create_depth_resources();
     create_framebuffers();
-    create_uniform_buffers();
-    create_descriptor_pool();
-    create_descriptor_sets();
-    create_command_buffers();
+
+    float recreate_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                            std::chrono::high_resolution_clock::now() - t_start)
+                            .count();
+    std::cout << "swap chain recreated at " << swap_chain_extent.width << "x" << swap_chain_extent.height
+              << " in " << recreate_ms << " ms" << std::endl;
 }
 
 void Application::create_instance()
@@ -365,6 +1045,8 @@ void Application::create_logical_device()
     std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
     std::set<uint32_t> unique_queue_families = {indices.graphics_family.value(),
                                                 indices.present_family.value()};
+    if (use_transfer_queue && indices.transfer_family.has_value())
+        unique_queue_families.insert(indices.transfer_family.value());
 
     float queue_priority = 1.0f;
     for (uint32_t queue_family : unique_queue_families)
@@ -377,8 +1059,17 @@ void Application::create_logical_device()
         queue_create_infos.push_back(queue_create_info);
     }
 
+    VkPhysicalDeviceFeatures supported_features;
+    vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+    multi_draw_indirect = supported_features.multiDrawIndirect;
+    bc_textures = supported_features.textureCompressionBC;
+    wireframe_supported = supported_features.fillModeNonSolid;
+
     VkPhysicalDeviceFeatures device_features{};
     device_features.samplerAnisotropy = VK_TRUE;
+    device_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+    device_features.textureCompressionBC = supported_features.textureCompressionBC;
+    device_features.fillModeNonSolid = supported_features.fillModeNonSolid;
 
     VkDeviceCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -399,11 +1090,28 @@ void Application::create_logical_device()
     else
         create_info.enabledLayerCount = 0;
 
+    //frames and uploads are scheduled on timeline semaphores
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features{};
+    timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timeline_features.timelineSemaphore = VK_TRUE;
+    create_info.pNext = &timeline_features;
+
     if (vkCreateDevice(physical_device, &create_info, nullptr, &device) != VK_SUCCESS)
         throw std::runtime_error("failed to create logical device!");
 
+    load_timeline_semaphore_functions(device);
+
     vkGetDeviceQueue(device, indices.graphics_family.value(), 0, &graphics_queue);
     vkGetDeviceQueue(device, indices.present_family.value(), 0, &present_queue);
+
+    if (use_transfer_queue && indices.transfer_family.has_value())
+        transfer_family = indices.transfer_family.value();
+    else
+        transfer_family = indices.graphics_family.value();
+    vkGetDeviceQueue(device, transfer_family, 0, &transfer_queue);
+
+    std::cout << "uploads on queue family " << transfer_family
+              << (transfer_family != indices.graphics_family.value() ? " (transfer only)" : " (graphics)") << std::endl;
 }
 
 QueueFamilyIndices Application::find_queue_families(VkPhysicalDevice device)
@@ -419,17 +1127,27 @@ QueueFamilyIndices Application::find_queue_families(VkPhysicalDevice device)
     uint32_t i = 0;
     for (const auto &queue_family : queue_families)
     {
-        if (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
-            indices.graphics_family = i;
+        if (!indices.is_complete())
+        {
+            if (queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+                indices.graphics_family = i;
 
-        VkBool32 present_support = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+            VkBool32 present_support = false;
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
 
-        if (present_support)
-            indices.present_family = i;
+            if (present_support)
+                indices.present_family = i;
+        }
 
-        if (indices.is_complete())
-            break;
+        /*DMA queues: no graphics, ideally no compute either. Mip levels and row bands are copied at
+        any offset, so only families with a 1x1x1 transfer granularity qualify.*/
+        VkExtent3D granularity = queue_family.minImageTransferGranularity;
+        bool transfer_only = (queue_family.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+        bool fine_grained = granularity.width == 1 && granularity.height == 1 && granularity.depth == 1;
+
+        if (transfer_only && fine_grained &&
+            (!indices.transfer_family.has_value() || !(queue_family.queueFlags & VK_QUEUE_COMPUTE_BIT)))
+            indices.transfer_family = i;
 
         ++i;
     }
@@ -485,7 +1203,8 @@ void Application::create_swap_chain()
     create_info.presentMode = present_mode;
     create_info.clipped = VK_TRUE;
 
-    create_info.oldSwapchain = VK_NULL_HANDLE;
+    //lets the driver hand over resources, the old one is retired and can't be acquired from anymore
+    create_info.oldSwapchain = swap_chain;
 
     if (vkCreateSwapchainKHR(device, &create_info, nullptr, &swap_chain) != VK_SUCCESS)
         throw std::runtime_error("failed to create swap chain!");
@@ -504,7 +1223,7 @@ void Application::create_image_views()
 
     for (size_t i = 0; i < swap_chain_images.size(); i++)
     {
-        swap_chain_image_views[i] = create_image_view(swap_chain_images[i], swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT);
+        swap_chain_image_views[i] = create_image_view(swap_chain_images[i], swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
     }
 }
 
@@ -573,162 +1292,177 @@ void Application::create_descriptor_layout()
 {
     VkDescriptorSetLayoutBinding ubo_layout_binding{};
     ubo_layout_binding.binding = 0;
-    ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     ubo_layout_binding.descriptorCount = 1;
     ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = 1;
+    layout_info.pBindings = &ubo_layout_binding;
+
+    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &descriptor_set_layout) != VK_SUCCESS)
+        throw std::runtime_error("failed to create descriptor set layout!");
+
+    //the texture lives in its own set so switching materials leaves set 0 bound
     VkDescriptorSetLayoutBinding sampler_layout_binding{};
-    sampler_layout_binding.binding = 1;
+    sampler_layout_binding.binding = 0;
     sampler_layout_binding.descriptorCount = 1;
     sampler_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     sampler_layout_binding.pImmutableSamplers = nullptr;
     sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> binding = {ubo_layout_binding, sampler_layout_binding};
+    layout_info.pBindings = &sampler_layout_binding;
 
-    VkDescriptorSetLayoutCreateInfo layout_info{};
-    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layout_info.bindingCount = static_cast<uint32_t>(binding.size());
-    layout_info.pBindings = binding.data();
+    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &material_set_layout) != VK_SUCCESS)
+        throw std::runtime_error("failed to create material descriptor set layout!");
+}
 
-    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &descriptor_set_layout) != VK_SUCCESS)
-        throw std::runtime_error("failed to create descriptor set layout!");
+void Application::create_pipeline_cache()
+{
+    if (!use_pipeline_cache)
+        return;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    pipeline_cache = load_pipeline_cache(device, properties, pipeline_cache_warm);
 }
 
-void Application::create_graphics_pipeline()
+void Application::create_pipeline_layout()
 {
-    //Shader Modules
-    auto vert_shader_code = read_file("shaders/bin/vert.spv");
-    auto frag_shader_code = read_file("shaders/bin/frag.spv");
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    std::array<VkDescriptorSetLayout, 2> set_layouts = {descriptor_set_layout, material_set_layout};
+    pipeline_layout_info.setLayoutCount = static_cast<uint32_t>(set_layouts.size());
+    pipeline_layout_info.pSetLayouts = set_layouts.data();
 
-    VkShaderModule vert_shader_module = create_shader_module(vert_shader_code);
-    VkShaderModule frag_shader_module = create_shader_module(frag_shader_code);
+    if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+        throw std::runtime_error("failed to create pipeline layout!");
+}
 
-    VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
-    vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vert_shader_stage_info.module = vert_shader_module;
-    vert_shader_stage_info.pName = "main";
+void Application::create_pipeline_registry()
+{
+    auto t_compile = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<char>> shaders = compile_shaders();
+    float compile_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                           std::chrono::high_resolution_clock::now() - t_compile)
+                           .count();
+    std::cout << "shaders compiled in " << compile_ms << " ms" << std::endl;
+
+    //indexed by PipelineKey::vertex_format, 0 is Vertex and 1 PackedVertex
+    std::vector<PipelineVertexInput> vertex_inputs(2);
+    auto attributes = Vertex::get_attribute_descriptions();
+    vertex_inputs[0].vertex_shader = std::move(shaders[0]);
+    vertex_inputs[0].binding = Vertex::get_binding_description();
+    vertex_inputs[0].attributes.assign(attributes.begin(), attributes.end());
+
+    auto packed_attributes = PackedVertex::get_attribute_descriptions();
+    vertex_inputs[1].vertex_shader = std::move(shaders[1]);
+    vertex_inputs[1].binding = PackedVertex::get_binding_description();
+    vertex_inputs[1].attributes.assign(packed_attributes.begin(), packed_attributes.end());
+
+    pipelines.create(device, pipeline_cache, thread_pool, vertex_inputs, shaders[2]);
+
+    if (use_shader_hot_reload && !shader_watcher.watch(SHADER_DIR))
+        std::cout << "failed to watch " << SHADER_DIR << ", shader hot reload is off" << std::endl;
+
+    PipelineKey opaque{};
+    opaque.vertex_format = use_packed_vertices ? 1 : 0;
+
+    //the only one compiled up front, everything else draws with it until its own pipeline is done
+    auto t_start = std::chrono::high_resolution_clock::now();
+    pipelines.set_render_pass(render_pass, pipeline_layout, opaque);
+    float pipeline_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                            std::chrono::high_resolution_clock::now() - t_start)
+                            .count();
+    std::cout << "fallback pipeline created in " << pipeline_ms << " ms ("
+              << (!use_pipeline_cache ? "no cache" : pipeline_cache_warm ? "warm cache" : "cold cache") << ")" << std::endl;
+
+    opaque_pipeline = pipelines.request(opaque);
+    wireframe_pipeline = opaque_pipeline;
+
+    //the other variants compile on thread_pool alongside the model load
+    std::vector<PipelineKey> variants;
+    for (BlendMode blend : {BlendMode::opaque, BlendMode::alpha, BlendMode::additive})
+    {
+        PipelineKey key = opaque;
+        key.blend = blend;
+        variants.push_back(key);
 
-    VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
-    frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    frag_shader_stage_info.module = frag_shader_module;
-    frag_shader_stage_info.pName = "main";
+        key.wireframe = 1;
+        if (wireframe_supported)
+            variants.push_back(key);
+    }
+    PipelineKey depth_only = opaque;
+    depth_only.depth_only = 1;
+    variants.push_back(depth_only);
 
-    VkPipelineShaderStageCreateInfo shader_stages[] = {vert_shader_stage_info, frag_shader_stage_info};
+    for (const PipelineKey &key : variants)
+    {
+        uint32_t id = pipelines.request(key);
+        if (key.wireframe && key.blend == BlendMode::opaque)
+            wireframe_pipeline = id;
+    }
+}
 
-    //Vertex Input
-    auto binding_description = Vertex::get_binding_description();
-    auto attribute_descriptions = Vertex::get_attribute_descriptions();
+//one job per source on thread_pool, unchanged sources come straight out of the SPIR-V cache
+std::vector<std::vector<char>> Application::compile_shaders()
+{
+    std::vector<std::future<std::vector<char>>> compiles;
+    for (const std::string &path : {VERTEX_SHADER_PATH, PACKED_VERTEX_SHADER_PATH, FRAGMENT_SHADER_PATH})
+        compiles.push_back(thread_pool.submit([path] { return compile_shader(path); }));
 
-    VkPipelineVertexInputStateCreateInfo vertex_input_info{};
-    vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_info.vertexBindingDescriptionCount = 1;
-    vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attribute_descriptions.size());
-    vertex_input_info.pVertexBindingDescriptions = &binding_description;
-    vertex_input_info.pVertexAttributeDescriptions = attribute_descriptions.data();
+    std::vector<std::vector<char>> shaders;
+    for (auto &compile : compiles)
+        shaders.push_back(thread_pool.wait(compile));
 
-    //Input Assembly
-    VkPipelineInputAssemblyStateCreateInfo input_assembly{};
-    input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    input_assembly.primitiveRestartEnable = VK_FALSE;
+    return shaders;
+}
 
-    //Viewports and Scissors
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swap_chain_extent.width;
-    viewport.height = (float)swap_chain_extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+/*A burst of saves starts one recompile, anything arriving while it runs queues exactly one more.
+A source that doesn't compile, or pipelines that fail to build from it, keep the current pipelines
+and log why.*/
+void Application::poll_shaders()
+{
+    if (!shader_watcher.poll().empty())
+    {
+        if (!shader_changed)
+            shader_change_time = std::chrono::high_resolution_clock::now();
+        shader_changed = true;
+    }
 
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = swap_chain_extent;
+    if (shader_compile.valid() && shader_compile.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        try
+        {
+            std::vector<std::vector<char>> shaders = shader_compile.get();
+            std::vector<char> fragment_shader = std::move(shaders.back());
+            shaders.pop_back();
 
-    VkPipelineViewportStateCreateInfo viewport_state{};
-    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewport_state.viewportCount = 1;
-    viewport_state.pViewports = &viewport;
-    viewport_state.scissorCount = 1;
-    viewport_state.pScissors = &scissor;
-
-    //Rasterizer
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizer.depthBiasClamp = VK_FALSE;
-
-    //Multisampling
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-    //depth pass
-    VkPipelineDepthStencilStateCreateInfo depth_stencil{};
-    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depth_stencil.depthTestEnable = VK_TRUE;
-    depth_stencil.depthWriteEnable = VK_TRUE;
-    depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
-    depth_stencil.depthBoundsTestEnable = VK_FALSE;
-    depth_stencil.stencilTestEnable = VK_FALSE;
-
-    //Color blending
-    VkPipelineColorBlendAttachmentState color_blend_attachment{};
-    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    color_blend_attachment.blendEnable = VK_FALSE;
-
-    VkPipelineColorBlendStateCreateInfo color_blending{};
-    color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    color_blending.logicOpEnable = VK_FALSE;
-    color_blending.logicOp = VK_LOGIC_OP_COPY; // Optional
-    color_blending.attachmentCount = 1;
-    color_blending.pAttachments = &color_blend_attachment;
-    color_blending.blendConstants[0] = 0.0f; // Optional
-    color_blending.blendConstants[1] = 0.0f; // Optional
-    color_blending.blendConstants[2] = 0.0f; // Optional
-    color_blending.blendConstants[3] = 0.0f; // Optional
-
-    //Create Layout
-    VkPipelineLayoutCreateInfo pipeline_layout_info{};
-    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_info.setLayoutCount = 1;
-    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+            pipelines.reload(shaders, fragment_shader);
+            shader_swap_pending = true;
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << e.what() << std::endl;
+        }
+    }
 
-    if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &pipeline_layout) != VK_SUCCESS)
-        throw std::runtime_error("failed to create pipeline layout!");
+    if (shader_changed && !shader_compile.valid())
+    {
+        shader_changed = false;
+        shader_compile = thread_pool.submit([this] { return compile_shaders(); });
+    }
+}
 
-    //Pipline
-    VkGraphicsPipelineCreateInfo pipeline_info{};
-    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_info.stageCount = 2;
-    pipeline_info.pStages = shader_stages;
-    pipeline_info.pVertexInputState = &vertex_input_info;
-    pipeline_info.pInputAssemblyState = &input_assembly;
-    pipeline_info.pViewportState = &viewport_state;
-    pipeline_info.pRasterizationState = &rasterizer;
-    pipeline_info.pMultisampleState = &multisampling;
-    pipeline_info.pDepthStencilState = &depth_stencil;
-    pipeline_info.pColorBlendState = &color_blending;
-    pipeline_info.layout = pipeline_layout;
-    pipeline_info.renderPass = render_pass;
-    pipeline_info.subpass = 0;
-    pipeline_info.basePipelineHandle = VK_NULL_HANDLE; // Optional
-    pipeline_info.basePipelineIndex = -1;              // Optional
-
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &graphics_pipeline) != VK_SUCCESS)
-        throw std::runtime_error("failed to create graphics pipeline!");
-
-    vkDestroyShaderModule(device, frag_shader_module, nullptr);
-    vkDestroyShaderModule(device, vert_shader_module, nullptr);
+void Application::destroy_retired_pipelines(uint64_t completed_frame)
+{
+    while (!retired_pipelines.empty() && retired_pipelines.front().first <= completed_frame)
+    {
+        vkDestroyPipeline(device, retired_pipelines.front().second, nullptr);
+        retired_pipelines.pop_front();
+    }
 }
 
 void Application::create_framebuffers()
@@ -755,26 +1489,50 @@ void Application::create_framebuffers()
     }
 }
 
-void Application::create_command_pool()
+void Application::create_command_pools()
 {
     QueueFamilyIndices queue_family_indices = find_queue_families(physical_device);
 
+    //everything is rerecorded every frame, pools are reset whole instead of per command buffer
     VkCommandPoolCreateInfo pool_info{};
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     pool_info.queueFamilyIndex = queue_family_indices.graphics_family.value();
-    pool_info.flags = 0;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    command_pools.resize(MAX_FRAMES_IN_FLIGHT);
+    record_command_pools.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+    {
+        if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pools[frame]) != VK_SUCCESS)
+            throw std::runtime_error("failed to create command pool!");
+
+        record_command_pools[frame].resize(RECORD_THREADS);
+        for (uint32_t job = 0; job < RECORD_THREADS; job++)
+        {
+            if (vkCreateCommandPool(device, &pool_info, nullptr, &record_command_pools[frame][job]) != VK_SUCCESS)
+                throw std::runtime_error("failed to create command pool!");
+        }
+    }
+}
+
+void Application::create_staging_ring()
+{
+    create_buffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                  staging_buffer, staging_buffer_memory);
 
-    if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) != VK_SUCCESS)
-        throw std::runtime_error("failed to create command pool!");
+    staging_ring.create(device, transfer_queue, transfer_family, graphics_queue, find_queue_families(physical_device).graphics_family.value(),
+                        staging_buffer, staging_buffer_memory.mapped, STAGING_RING_SIZE);
 }
 
 void Application::create_depth_resources()
 {
     VkFormat depth_format = find_depth_format();
-    create_image(swap_chain_extent.width, swap_chain_extent.height, depth_format,
+    create_image(swap_chain_extent.width, swap_chain_extent.height, 1, depth_format,
                  VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depth_image, depth_image_memory);
-    depth_image_view = create_image_view(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT);
+    depth_image_view = create_image_view(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 }
 
 VkFormat Application::find_depth_format()
@@ -798,59 +1556,234 @@ VkFormat Application::find_supported_format(const std::vector<VkFormat> &candida
             return format;
     }
 
-    throw std::runtime_error("failed to find supported format!");
-}
+    throw std::runtime_error("failed to find supported format!");
+}
+
+bool has_stencil_component(VkFormat format)
+{
+    return format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+           format == VK_FORMAT_D24_UNORM_S8_UINT;
+}
+
+//no Vulkan calls, safe to run on thread_pool
+TextureData Application::load_texture(const std::string &path, bool cpu_mipmaps, bool bc_supported, ThreadPool &pool)
+{
+    TextureData texture;
+
+    //precompressed levels upload as they are, the png/jpg stays the fallback
+    std::string ktx2_path = path.substr(0, path.find_last_of('.')) + ".ktx2";
+    std::string err;
+
+    if (use_ktx2_textures && bc_supported && std::ifstream(ktx2_path).good())
+    {
+        if (load_ktx2(ktx2_path, texture, &err))
+        {
+            if (!use_mipmaps)
+                texture.mip_levels = 1;
+            texture.level_offsets.resize(texture.mip_levels);
+            return texture;
+        }
+        std::cerr << err << ", decoding " << path << " instead" << std::endl;
+    }
+
+    //encoded on an earlier run
+    bool compress = use_texture_compression && bc_supported;
+    std::string cache_path = compress ? texture_cache_path(path) : "";
+
+    if (!cache_path.empty() && std::ifstream(cache_path).good())
+    {
+        if (load_ktx2(cache_path, texture, &err))
+        {
+            if (!use_mipmaps)
+                texture.mip_levels = 1;
+            texture.level_offsets.resize(texture.mip_levels);
+            return texture;
+        }
+        std::cerr << err << ", encoding " << path << " again" << std::endl;
+    }
+
+    int txr_width, txr_height, txr_channels;
+    stbi_uc *pixels = stbi_load(path.c_str(), &txr_width, &txr_height, &txr_channels, STBI_rgb_alpha);
+
+    if (!pixels)
+    {
+        std::cerr << "failed to load " << path << ", using textures/null.png" << std::endl;
+        pixels = stbi_load("textures/null.png", &txr_width, &txr_height, &txr_channels, STBI_rgb_alpha);
+    }
+
+    if (!pixels)
+        throw std::runtime_error("failed to load texture image");
+
+    texture.width = static_cast<uint32_t>(txr_width);
+    texture.height = static_cast<uint32_t>(txr_height);
+    if (use_mipmaps)
+        texture.mip_levels = mip_level_count(texture.width, texture.height);
+
+    //without CPU levels only level 0 is uploaded and the rest is blitted, BC images can't be blit targets
+    texture.data.reserve(pack_level_offsets(texture, cpu_mipmaps || compress ? texture.mip_levels : 1));
+    texture.data.assign(pixels, pixels + level_size(texture.format, texture.width, texture.height));
+    stbi_image_free(pixels);
+
+    if (texture.level_offsets.size() > 1)
+        build_mip_chain(texture.data, texture.width, texture.height);
+
+    if (compress)
+    {
+        auto t_start = std::chrono::high_resolution_clock::now();
+        texture = compress_bc(texture, pool);
+        auto t_end = std::chrono::high_resolution_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+        double megapixels = texture.width * texture.height * 4.0 / 3.0 / 1e6; //whole chain
+        std::cout << path << " -> " << (block_size(texture.format) == BC7_BLOCK_SIZE ? "BC7" : "BC1")
+                  << " (" << bc_encoder_kernel() << "): " << ms << "ms, " << megapixels / ms * 1000.0 << " MP/s" << std::endl;
+
+        if (!cache_path.empty() && !write_ktx2(cache_path, texture))
+            std::cerr << "failed to write " << cache_path << std::endl;
+    }
+
+    return texture;
+}
+
+void Application::create_texture_image(const TextureData &texture, VkImage &image, GpuAllocation &image_memory)
+{
+    //levels missing from data are blitted down from level 0, which needs it as a transfer source
+    bool blit = texture.level_offsets.size() < texture.mip_levels;
+
+    create_image(texture.width, texture.height, texture.mip_levels, texture.format, VK_IMAGE_TILING_OPTIMAL,
+                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, image_memory);
+
+    //recorded into the open staging batch, submitted by the caller together with whatever else it uploads
+    transition_image_layout(staging_ring.command_buffer(), image,
+                            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture.mip_levels);
+    upload_image_levels(image, texture);
+
+    //command buffers fetched again, the copies may have filled the ring and moved on to a new batch
+    if (staging_ring.ownership_transfer())
+        acquire_image(image, texture.mip_levels, blit ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    else if (!blit)
+        transition_image_layout(staging_ring.command_buffer(), image,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, texture.mip_levels);
+
+    //blits need a graphics queue, with ownership transfer they run after the acquire
+    if (blit)
+        generate_mipmaps(staging_ring.acquire_command_buffer(), image, texture.width, texture.height, texture.mip_levels);
+}
+
+/*Queue family ownership transfer of all levels from the transfer queue to graphics, changing the
+layout on the way: the release goes into the batch's transfer commands, the matching acquire into
+its graphics commands.*/
+void Application::acquire_image(VkImage image, uint32_t mip_levels, VkImageLayout new_layout)
+{
+    bool shader_read = new_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = staging_ring.family();
+    barrier.dstQueueFamilyIndex = staging_ring.graphics_family();
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mip_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(staging_ring.command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
 
-bool has_stencil_component(VkFormat format)
-{
-    return format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
-           format == VK_FORMAT_D24_UNORM_S8_UINT;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = shader_read ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(staging_ring.acquire_command_buffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         shader_read ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
 }
 
-void Application::create_texture_image()
+/*vkCmdBlitImage cascade, each level filtered from the previous one. Every level ends up in
+SHADER_READ_ONLY_OPTIMAL as soon as the next one has been blitted from it.*/
+void Application::generate_mipmaps(VkCommandBuffer command_buffer, VkImage image, int32_t width, int32_t height, uint32_t mip_levels)
 {
-    int txr_width, txr_height, txr_channels;
-    stbi_uc *pixels = stbi_load(TEXTURE_PATH.c_str(), &txr_width, &txr_height, &txr_channels, STBI_rgb_alpha);
-    VkDeviceSize image_size = txr_width * txr_height * 4;
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.levelCount = 1;
 
-    if (!pixels)
+    for (uint32_t i = 1; i < mip_levels; i++)
     {
-        pixels = stbi_load("textures/null.png", &txr_width, &txr_height, &txr_channels, STBI_rgb_alpha);
-        image_size = txr_width * txr_height * 4;
-    }
-    else if (!pixels)
-        throw std::runtime_error("failed to load texture image");
-
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
-    create_buffer(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  staging_buffer, staging_buffer_memory);
+        barrier.subresourceRange.baseMipLevel = i - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        int32_t next_width = std::max(width / 2, 1);
+        int32_t next_height = std::max(height / 2, 1);
+
+        VkImageBlit blit{};
+        blit.srcOffsets[0] = {0, 0, 0};
+        blit.srcOffsets[1] = {width, height, 1};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = i - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[0] = {0, 0, 0};
+        blit.dstOffsets[1] = {next_width, next_height, 1};
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = i;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+
+        vkCmdBlitImage(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       1, &blit, VK_FILTER_LINEAR);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-    void *data;
-    vkMapMemory(device, staging_buffer_memory, 0, image_size, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(image_size));
-    vkUnmapMemory(device, staging_buffer_memory);
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
 
-    stbi_image_free(pixels);
+        width = next_width;
+        height = next_height;
+    }
 
-    create_image(txr_width, txr_height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture_image, texture_image_memory);
+    //the last level was only ever written
+    barrier.subresourceRange.baseMipLevel = mip_levels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-    transition_image_layout(texture_image, VK_FORMAT_R8G8B8_SRGB,
-                            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copy_buffer_to_image(staging_buffer, texture_image, static_cast<uint32_t>(txr_width), static_cast<uint32_t>(txr_height));
-    transition_image_layout(texture_image, VK_FORMAT_R8G8B8A8_SRGB,
-                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+}
 
-    vkDestroyBuffer(device, staging_buffer, nullptr);
-    vkFreeMemory(device, staging_buffer_memory, nullptr);
+void Application::create_placeholder_texture()
+{
+    TextureData texture = load_texture(TEXTURE_PATH, !blit_mipmaps, bc_textures, thread_pool);
+    create_texture_image(texture, placeholder_image, placeholder_image_memory);
+    staging_ring.wait(staging_ring.submit());
+    placeholder_image_view = create_image_view(placeholder_image, texture.format, VK_IMAGE_ASPECT_COLOR_BIT, texture.mip_levels);
 }
 
-void Application::create_texture_image_view()
+//records the upload into the open staging batch, the material set keeps the placeholder until the caller swaps it in
+void Application::upload_texture(size_t material, const TextureData &texture)
 {
-    texture_image_view = create_image_view(texture_image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+    create_texture_image(texture, texture_images[material], texture_images_memory[material]);
+    texture_image_views[material] = create_image_view(texture_images[material], texture.format, VK_IMAGE_ASPECT_COLOR_BIT, texture.mip_levels);
 }
 
 void Application::create_texture_sampler()
@@ -858,6 +1791,10 @@ void Application::create_texture_sampler()
     VkPhysicalDeviceProperties properties{};
     vkGetPhysicalDeviceProperties(physical_device, &properties);
 
+    VkFormatProperties format_properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_R8G8B8A8_SRGB, &format_properties);
+    blit_mipmaps = format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
     VkSamplerCreateInfo sampler_info{};
     sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
     sampler_info.magFilter = VK_FILTER_LINEAR;
@@ -874,13 +1811,71 @@ void Application::create_texture_sampler()
     sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     sampler_info.mipLodBias = 0.0f;
     sampler_info.minLod = 0.0f;
-    sampler_info.maxLod = 0.0f;
+    sampler_info.maxLod = use_mipmaps ? VK_LOD_CLAMP_NONE : 0.0f;
 
     if (vkCreateSampler(device, &sampler_info, nullptr, &texture_sampler) != VK_SUCCESS)
         throw std::runtime_error("failed to create texture sampler!");
 }
 
-VkImageView Application::create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags)
+/*one set per texture and frame in flight, starting out on the placeholder; these outlive swap chain
+recreation. Each frame binds its own copy so swapping a texture in never touches a set the GPU still reads*/
+void Application::create_material_descriptor_sets()
+{
+    uint32_t set_count = static_cast<uint32_t>(material_textures.size() * MAX_FRAMES_IN_FLIGHT);
+
+    VkDescriptorPoolSize pool_size{};
+    pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_size.descriptorCount = set_count;
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    pool_info.maxSets = set_count;
+
+    if (vkCreateDescriptorPool(device, &pool_info, nullptr, &material_descriptor_pool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create material descriptor pool!");
+
+    std::vector<VkDescriptorSetLayout> layouts(material_textures.size(), material_set_layout);
+
+    VkDescriptorSetAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = material_descriptor_pool;
+    alloc_info.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+    alloc_info.pSetLayouts = layouts.data();
+
+    material_descriptor_sets.assign(MAX_FRAMES_IN_FLIGHT, std::vector<VkDescriptorSet>(layouts.size()));
+    material_writes.assign(MAX_FRAMES_IN_FLIGHT, {});
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+    {
+        if (vkAllocateDescriptorSets(device, &alloc_info, material_descriptor_sets[frame].data()) != VK_SUCCESS)
+            throw std::runtime_error("failed to allocate material descriptor sets!");
+
+        for (size_t i = 0; i < layouts.size(); i++)
+            write_material_descriptor(frame, i, placeholder_image_view);
+    }
+}
+
+void Application::write_material_descriptor(size_t frame, size_t material, VkImageView image_view)
+{
+    VkDescriptorImageInfo image_info{};
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    image_info.imageView = image_view;
+    image_info.sampler = texture_sampler;
+
+    VkWriteDescriptorSet descriptor_write{};
+    descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptor_write.dstSet = material_descriptor_sets[frame][material];
+    descriptor_write.dstBinding = 0;
+    descriptor_write.dstArrayElement = 0;
+    descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptor_write.descriptorCount = 1;
+    descriptor_write.pImageInfo = &image_info;
+
+    vkUpdateDescriptorSets(device, 1, &descriptor_write, 0, nullptr);
+}
+
+VkImageView Application::create_image_view(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags, uint32_t mip_levels)
 {
     VkImageViewCreateInfo view_info{};
     view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -889,7 +1884,7 @@ VkImageView Application::create_image_view(VkImage image, VkFormat format, VkIma
     view_info.format = format;
     view_info.subresourceRange.aspectMask = aspect_flags;
     view_info.subresourceRange.baseMipLevel = 0;
-    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.levelCount = mip_levels;
     view_info.subresourceRange.baseArrayLayer = 0;
     view_info.subresourceRange.layerCount = 1;
 
@@ -900,9 +1895,9 @@ VkImageView Application::create_image_view(VkImage image, VkFormat format, VkIma
     return image_view;
 }
 
-void Application::create_image(uint32_t width, uint32_t height, VkFormat format,
+void Application::create_image(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format,
                                VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-                               VkImage &image, VkDeviceMemory &image_memory)
+                               VkImage &image, GpuAllocation &image_memory)
 {
     VkImageCreateInfo image_info{};
     image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -910,7 +1905,7 @@ void Application::create_image(uint32_t width, uint32_t height, VkFormat format,
     image_info.extent.width = width;
     image_info.extent.height = height;
     image_info.extent.depth = 1;
-    image_info.mipLevels = 1;
+    image_info.mipLevels = mip_levels;
     image_info.arrayLayers = 1;
     image_info.format = format;
     image_info.tiling = tiling;
@@ -925,22 +1920,13 @@ void Application::create_image(uint32_t width, uint32_t height, VkFormat format,
     VkMemoryRequirements mem_requirements;
     vkGetImageMemoryRequirements(device, image, &mem_requirements);
 
-    VkMemoryAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = find_memory_type(mem_requirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &alloc_info, nullptr, &image_memory) != VK_SUCCESS)
-        throw std::runtime_error("failed to allocate image memory!");
-
-    vkBindImageMemory(device, image, image_memory, 0);
+    image_memory = gpu_allocator.allocate(mem_requirements, properties, tiling == VK_IMAGE_TILING_LINEAR);
+    vkBindImageMemory(device, image, image_memory.memory, image_memory.offset);
 }
 
-void Application::transition_image_layout(VkImage image, VkFormat format,
-                                          VkImageLayout old_layout, VkImageLayout new_layout)
+void Application::transition_image_layout(VkCommandBuffer command_buffer, VkImage image,
+                                          VkImageLayout old_layout, VkImageLayout new_layout, uint32_t mip_levels)
 {
-    VkCommandBuffer command_buffer = begin_single_time_commands();
-
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = old_layout;
@@ -950,7 +1936,7 @@ void Application::transition_image_layout(VkImage image, VkFormat format,
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = mip_levels;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
 
@@ -981,164 +1967,186 @@ void Application::transition_image_layout(VkImage image, VkFormat format,
     }
 
     vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-    end_single_time_commands(command_buffer);
 }
 
-void Application::copy_buffer_to_image(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+/*Records copies of every level in texture.data into the open staging batch. Levels bigger than
+STAGING_CHUNK_SIZE go in bands of whole block rows, each band its own region.*/
+void Application::upload_image_levels(VkImage image, const TextureData &texture)
 {
-    VkCommandBuffer command_buffer = begin_single_time_commands();
+    uint32_t block_rows = block_size(texture.format) ? 4 : 1; //texel rows per row of blocks
 
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {
-        width,
-        height,
-        1};
+    for (uint32_t level = 0; level < texture.level_offsets.size(); level++)
+    {
+        uint32_t width = std::max(texture.width >> level, 1u);
+        uint32_t height = std::max(texture.height >> level, 1u);
+        VkDeviceSize row_size = level_size(texture.format, width, block_rows);
+        uint32_t rows_per_chunk = static_cast<uint32_t>(std::max<VkDeviceSize>(STAGING_CHUNK_SIZE / row_size, 1)) * block_rows;
+        const uint8_t *level_data = texture.data.data() + texture.level_offsets[level];
+
+        for (uint32_t y = 0; y < height; y += rows_per_chunk)
+        {
+            uint32_t rows = std::min(rows_per_chunk, height - y);
+            VkDeviceSize size = level_size(texture.format, width, rows);
+
+            //16 covers the texel block size of every format we upload
+            VkDeviceSize offset = staging_ring.allocate(size, 16);
+            memcpy(staging_ring.data(offset), level_data + y / block_rows * row_size, size);
+
+            VkBufferImageCopy region{};
+            region.bufferOffset = offset;
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = level;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, static_cast<int32_t>(y), 0};
+            region.imageExtent = {
+                width,
+                rows,
+                1};
+
+            vkCmdCopyBufferToImage(staging_ring.command_buffer(), staging_ring.buffer(), image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        }
+    }
+}
+
+void Application::create_geometry_arena(VkDeviceSize min_size)
+{
+    //room for more meshes than the one loaded, a model larger than the default gets an arena its size
+    VkDeviceSize size = std::max(GEOMETRY_ARENA_SIZE, min_size);
 
-    vkCmdCopyBufferToImage(command_buffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, geometry_buffer, geometry_buffer_memory);
 
-    end_single_time_commands(command_buffer);
+    geometry_arena.create(geometry_buffer, size);
 }
 
-void Application::create_vertex_buffer()
+void Application::upload_geometry()
 {
-    VkDeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
+    //warm starts copy straight out of the mapped cache
+    const void *vertex_data;
+    const void *index_data;
+    VkDeviceSize vertex_stride;
+    VkDeviceSize index_stride;
 
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  staging_buffer, staging_buffer_memory);
+    if (use_packed_vertices)
+    {
+        vertex_data = mesh_cache.is_open() ? mesh_cache.data(MeshCacheSection::packed_vertices) : packed_vertices.data();
+        vertex_stride = sizeof(PackedVertex);
+    }
+    else
+    {
+        vertex_data = mesh_cache.is_open() ? mesh_cache.data(MeshCacheSection::vertices) : vertices.data();
+        vertex_stride = sizeof(Vertex);
+    }
+
+    if (use_16bit_indices)
+    {
+        index_data = mesh_cache.is_open() ? mesh_cache.data(MeshCacheSection::indices16) : indices16.data();
+        index_stride = sizeof(uint16_t);
+    }
+    else
+    {
+        index_data = mesh_cache.is_open() ? mesh_cache.data(MeshCacheSection::indices) : indices.data();
+        index_stride = sizeof(uint32_t);
+    }
 
-    void *data;
-    vkMapMemory(device, staging_buffer_memory, 0, buffer_size, 0, &data);
-    memcpy(data, vertices.data(), (size_t)buffer_size);
-    vkUnmapMemory(device, staging_buffer_memory);
+    //worst case alignment padding in front of each range
+    if (geometry_buffer == VK_NULL_HANDLE)
+        create_geometry_arena(vertex_stride * (vertex_count + 1) + index_stride * (index_count + 1));
 
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer, vertex_buffer_memory);
+    mesh_geometry = geometry_arena.allocate(vertex_count, vertex_stride, index_count, index_stride);
 
-    copy_buffer(staging_buffer, vertex_buffer, buffer_size);
+    upload_buffer(geometry_arena.buffer(), mesh_geometry.vertex_offset, vertex_data, mesh_geometry.vertex_size);
+    upload_buffer(geometry_arena.buffer(), mesh_geometry.index_offset, index_data, mesh_geometry.index_size);
 
-    vkDestroyBuffer(device, staging_buffer, nullptr);
-    vkFreeMemory(device, staging_buffer_memory, nullptr);
+    std::cout << "geometry arena: " << geometry_arena.used() / (1024.0f * 1024.0f) << " of "
+              << geometry_arena.size() / (1024.0f * 1024.0f) << " MB used" << std::endl;
 }
 
-void Application::create_index_buffer()
+void Application::create_uniform_ring()
 {
-    VkDeviceSize buffer_size = sizeof(indices[0]) * indices.size();
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
 
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    uint32_t frame_count = MAX_FRAMES_IN_FLIGHT;
+    create_buffer(UniformRing::buffer_size(frame_count, alignment), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                  staging_buffer, staging_buffer_memory);
+                  uniform_buffer, uniform_buffer_memory);
 
-    void *data;
-    vkMapMemory(device, staging_buffer_memory, 0, buffer_size, 0, &data);
-    memcpy(data, indices.data(), (size_t)buffer_size);
-    vkUnmapMemory(device, staging_buffer_memory);
-
-    create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer, index_buffer_memory);
-
-    copy_buffer(staging_buffer, index_buffer, buffer_size);
-
-    vkDestroyBuffer(device, staging_buffer, nullptr);
-    vkFreeMemory(device, staging_buffer_memory, nullptr);
+    uniform_ring.create(uniform_buffer, uniform_buffer_memory.mapped, frame_count, alignment);
 }
 
-void Application::create_uniform_buffers()
+void Application::create_indirect_buffers()
 {
-    VkDeviceSize buffer_size = sizeof(UniformBufferObject);
+    //sized by the meshlets, so a background load creates them once the mesh arrives
+    if (!use_meshlet_culling || !mesh_ready)
+        return;
 
-    uniform_buffers.resize(swap_chain_images.size());
-    uniform_buffers_memory.resize(swap_chain_images.size());
+    VkDeviceSize buffer_size = sizeof(VkDrawIndexedIndirectCommand) * meshlets.size();
 
-    for (size_t i = 0; i < swap_chain_images.size(); i++)
+    indirect_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+    indirect_buffers_memory.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
-        create_buffer(buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        create_buffer(buffer_size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      uniform_buffers[i], uniform_buffers_memory[i]);
+                      indirect_buffers[i], indirect_buffers_memory[i]);
     }
 }
 
 void Application::create_descriptor_pool()
 {
-    std::array<VkDescriptorPoolSize, 2> pool_sizes{};
-    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    pool_sizes[0].descriptorCount = static_cast<uint32_t>(swap_chain_images.size());
-    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    pool_sizes[1].descriptorCount = static_cast<uint32_t>(swap_chain_images.size());
+    std::array<VkDescriptorPoolSize, 1> pool_sizes{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    pool_sizes[0].descriptorCount = 1;
 
     VkDescriptorPoolCreateInfo pool_info{};
     pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     pool_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
     pool_info.pPoolSizes = pool_sizes.data();
-    pool_info.maxSets = static_cast<uint32_t>(swap_chain_images.size());
+    pool_info.maxSets = 1;
 
     if (vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptor_pool) != VK_SUCCESS)
         throw std::runtime_error("failed to create descriptor pool!");
 }
 
-void Application::create_descriptor_sets()
+void Application::create_descriptor_set()
 {
-    std::vector<VkDescriptorSetLayout> layouts(swap_chain_images.size(), descriptor_set_layout);
-
     VkDescriptorSetAllocateInfo alloc_info{};
     alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     alloc_info.descriptorPool = descriptor_pool;
-    alloc_info.descriptorSetCount = static_cast<uint32_t>(swap_chain_images.size());
-    alloc_info.pSetLayouts = layouts.data();
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &descriptor_set_layout;
 
-    descriptor_sets.resize(swap_chain_images.size());
-    if (vkAllocateDescriptorSets(device, &alloc_info, descriptor_sets.data()) != VK_SUCCESS)
+    if (vkAllocateDescriptorSets(device, &alloc_info, &descriptor_set) != VK_SUCCESS)
         throw std::runtime_error("failed to allocate descriptor sets!");
 
-    for (size_t i = 0; i < swap_chain_images.size(); i++)
-    {
-        VkDescriptorBufferInfo buffer_info{};
-        buffer_info.buffer = uniform_buffers[i];
-        buffer_info.offset = 0;
-        buffer_info.range = sizeof(UniformBufferObject);
-
-        VkDescriptorImageInfo image_info{};
-        image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        image_info.imageView = texture_image_view;
-        image_info.sampler = texture_sampler;
-
-        std::array<VkWriteDescriptorSet, 2> descriptor_writes{};
+    //offset 0, the dynamic offset picks the block
+    VkDescriptorBufferInfo buffer_info{};
+    buffer_info.buffer = uniform_ring.buffer();
+    buffer_info.offset = 0;
+    buffer_info.range = sizeof(UniformBufferObject);
 
-        descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptor_writes[0].dstSet = descriptor_sets[i];
-        descriptor_writes[0].dstBinding = 0;
-        descriptor_writes[0].dstArrayElement = 0;
-        descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptor_writes[0].descriptorCount = 1;
-        descriptor_writes[0].pBufferInfo = &buffer_info;
+    std::array<VkWriteDescriptorSet, 1> descriptor_writes{};
 
-        descriptor_writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptor_writes[1].dstSet = descriptor_sets[i];
-        descriptor_writes[1].dstBinding = 1;
-        descriptor_writes[1].dstArrayElement = 0;
-        descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptor_writes[1].descriptorCount = 1;
-        descriptor_writes[1].pImageInfo = &image_info;
+    descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptor_writes[0].dstSet = descriptor_set;
+    descriptor_writes[0].dstBinding = 0;
+    descriptor_writes[0].dstArrayElement = 0;
+    descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptor_writes[0].descriptorCount = 1;
+    descriptor_writes[0].pBufferInfo = &buffer_info;
 
-        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptor_writes.size()), descriptor_writes.data(), 0, nullptr);
-    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptor_writes.size()), descriptor_writes.data(), 0, nullptr);
 }
 
 void Application::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                                VkBuffer &buffer, VkDeviceMemory &buffer_memory)
+                                VkBuffer &buffer, GpuAllocation &buffer_memory)
 {
     VkBufferCreateInfo buffer_info{};
     buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1152,153 +2160,527 @@ void Application::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkM
     VkMemoryRequirements mem_requirements;
     vkGetBufferMemoryRequirements(device, buffer, &mem_requirements);
 
-    VkMemoryAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = find_memory_type(mem_requirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &alloc_info, nullptr, &buffer_memory) != VK_SUCCESS)
-        throw std::runtime_error("failed to allocate vertex buffer memory!");
-
-    vkBindBufferMemory(device, buffer, buffer_memory, 0);
+    buffer_memory = gpu_allocator.allocate(mem_requirements, properties, true);
+    vkBindBufferMemory(device, buffer, buffer_memory.memory, buffer_memory.offset);
 }
 
-VkCommandBuffer Application::begin_single_time_commands()
+/*Records copies of data into buffer, in chunks of at most STAGING_CHUNK_SIZE, into the open
+staging batch. A barrier after the last one (or an ownership transfer to graphics) makes them
+visible to later vertex input on the graphics queue once the caller submits the batch.*/
+void Application::upload_buffer(VkBuffer buffer, VkDeviceSize buffer_offset, const void *data, VkDeviceSize size)
 {
-    VkCommandBufferAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandPool = command_pool;
-    alloc_info.commandBufferCount = 1;
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
 
-    VkCommandBuffer command_buffer;
-    vkAllocateCommandBuffers(device, &alloc_info, &command_buffer);
+    for (VkDeviceSize copied = 0; copied < size;)
+    {
+        VkDeviceSize chunk = std::min(size - copied, STAGING_CHUNK_SIZE);
 
-    VkCommandBufferBeginInfo begin_info{};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VkDeviceSize offset = staging_ring.allocate(chunk, 16);
+        memcpy(staging_ring.data(offset), bytes + copied, chunk);
+
+        VkBufferCopy copy_region{};
+        copy_region.srcOffset = offset;
+        copy_region.dstOffset = buffer_offset + copied;
+        copy_region.size = chunk;
+        vkCmdCopyBuffer(staging_ring.command_buffer(), staging_ring.buffer(), buffer, 1, &copy_region);
+
+        copied += chunk;
+    }
 
-    vkBeginCommandBuffer(command_buffer, &begin_info);
+    if (!staging_ring.ownership_transfer())
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+
+        vkCmdPipelineBarrier(staging_ring.command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+        return;
+    }
 
-    return command_buffer;
+    //release on the transfer queue, acquire on graphics
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = staging_ring.family();
+    barrier.dstQueueFamilyIndex = staging_ring.graphics_family();
+    barrier.buffer = buffer;
+    barrier.offset = buffer_offset;
+    barrier.size = size;
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(staging_ring.command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    vkCmdPipelineBarrier(staging_ring.acquire_command_buffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                         0, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
-void Application::end_single_time_commands(VkCommandBuffer command_buffer)
+void Application::create_command_buffers()
 {
-    vkEndCommandBuffer(command_buffer);
+    command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+    secondary_command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
 
-    VkSubmitInfo submit_info{};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+    {
+        VkCommandBufferAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = command_pools[frame];
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
 
-    vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphics_queue);
+        if (vkAllocateCommandBuffers(device, &alloc_info, &command_buffers[frame]) != VK_SUCCESS)
+            throw std::runtime_error("failed to allocate command buffers!");
+
+        secondary_command_buffers[frame].resize(RECORD_THREADS);
+        for (uint32_t job = 0; job < RECORD_THREADS; job++)
+        {
+            alloc_info.commandPool = record_command_pools[frame][job];
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
 
-    vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+            if (vkAllocateCommandBuffers(device, &alloc_info, &secondary_command_buffers[frame][job]) != VK_SUCCESS)
+                throw std::runtime_error("failed to allocate secondary command buffers!");
+        }
+    }
 }
 
-void Application::copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size)
+//what this frame draws, rebuilt every frame so culled meshlets aren't recorded at all
+void Application::build_draw_list()
 {
-    VkCommandBuffer command_buffer = begin_single_time_commands();
+    draw_list.clear();
+
+    if (!mesh_ready)
+        return;
 
-    VkBufferCopy copy_region{};
-    copy_region.size = size;
-    vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
+    if (use_meshlet_culling)
+    {
+        for (const auto &range : draw_ranges)
+        {
+            if (range.lod != current_lod)
+                continue;
+
+            if (multi_draw_indirect)
+            {
+                draw_list.push_back({range.material, 0, 0, 0, range.first_meshlet, range.meshlet_count});
+                continue;
+            }
+
+            for (uint32_t m = range.first_meshlet; m < range.first_meshlet + range.meshlet_count; m++)
+            {
+                if (!meshlet_visible[m])
+                    continue;
 
-    end_single_time_commands(command_buffer);
+                const Meshlet &meshlet = meshlets[m];
+                draw_list.push_back({range.material, meshlet.index_count, mesh_geometry.first_index + meshlet.first_index,
+                                     static_cast<int32_t>(mesh_geometry.base_vertex + meshlet.vertex_offset), 0, 0});
+            }
+        }
+    }
+    else
+    {
+        for (const auto &submesh : submeshes)
+            draw_list.push_back({submesh.material, submesh.index_count, mesh_geometry.first_index + submesh.first_index,
+                                 static_cast<int32_t>(mesh_geometry.base_vertex + submesh.vertex_offset), 0, 0});
+    }
 }
 
-uint32_t Application::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties)
+/*draw_list[first, first + count) into a secondary command buffer that continues the render pass.
+Secondaries inherit no state, so each one binds the pipeline, geometry and set 0 itself.
+Runs on record_pool, touching nothing but command_buffer and its own pool.*/
+void Application::record_draws(VkCommandBuffer command_buffer, uint32_t image_index, size_t first, size_t count,
+                               uint32_t &binds, uint32_t &draws)
 {
-    VkPhysicalDeviceMemoryProperties mem_properties;
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
+    VkCommandBufferInheritanceInfo inheritance_info{};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.renderPass = render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = swap_chain_framebuffers[image_index];
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+
+    if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+        throw std::runtime_error("falied to begin recording command buffer!");
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.get(wireframe ? wireframe_pipeline : opaque_pipeline));
+
+    //secondaries don't inherit dynamic state from the primary
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)swap_chain_extent.width;
+    viewport.height = (float)swap_chain_extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
 
-    for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++)
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = swap_chain_extent;
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    //bound once for every mesh, draws pick their range with firstIndex and vertexOffset
+    VkBuffer vertex_buffers[] = {geometry_arena.buffer()};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+    vkCmdBindIndexBuffer(command_buffer, geometry_arena.buffer(), 0, use_16bit_indices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+    //the camera block is always the first push of the frame
+    uint32_t ubo_offset = uniform_ring.frame_offset(static_cast<uint32_t>(current_frame));
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &descriptor_set, 1, &ubo_offset);
+
+    binds = 1;
+    draws = 0;
+    uint32_t bound_material = UINT32_MAX;
+
+    for (size_t i = first; i < first + count; i++)
     {
-        if ((type_filter & (1 << i)) &&
-            (mem_properties.memoryTypes[i].propertyFlags & properties) == properties)
+        const DrawCommand &draw = draw_list[i];
+
+        if (draw.material != bound_material || !use_material_sorting)
         {
-            return i;
+            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1, 1,
+                                    &material_descriptor_sets[current_frame][draw.material], 0, nullptr);
+            bound_material = draw.material;
+            binds++;
         }
+
+        if (draw.indirect_count > 0)
+            vkCmdDrawIndexedIndirect(command_buffer, indirect_buffers[current_frame], draw.first_indirect * sizeof(VkDrawIndexedIndirectCommand),
+                                     draw.indirect_count, sizeof(VkDrawIndexedIndirectCommand));
+        else
+            vkCmdDrawIndexed(command_buffer, draw.index_count, 1, draw.first_index, draw.vertex_offset, 0);
+        draws++;
     }
 
-    throw std::runtime_error("failed to find suitable memory type!");
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+        throw std::runtime_error("falied torecord command buffer!");
 }
 
-void Application::create_command_buffers()
+//called once the frame's fence has signalled, nothing recorded from its pools is still pending
+void Application::record_command_buffer(uint32_t image_index)
 {
-    command_buffers.resize(swap_chain_framebuffers.size());
+    auto t_start = std::chrono::high_resolution_clock::now();
 
-    VkCommandBufferAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.commandPool = command_pool;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+    vkResetCommandPool(device, command_pools[current_frame], 0);
+    for (VkCommandPool pool : record_command_pools[current_frame])
+        vkResetCommandPool(device, pool, 0);
 
-    if (vkAllocateCommandBuffers(device, &alloc_info, command_buffers.data()) != VK_SUCCESS)
-        throw std::runtime_error("failed to allocate command buffers!");
+    //no more jobs than there are draws to make them worth it
+    size_t jobs = std::min<size_t>(record_threads, draw_list.size() / MIN_DRAWS_PER_RECORD_JOB);
+    jobs = std::max<size_t>(jobs, draw_list.empty() ? 0 : 1);
 
-    for (size_t i = 0; i < command_buffers.size(); i++)
+    std::vector<uint32_t> binds(jobs), draws(jobs);
+    std::vector<std::future<void>> recordings;
+    const std::vector<VkCommandBuffer> &secondaries = secondary_command_buffers[current_frame];
+
+    for (size_t job = 0; job < jobs; job++)
     {
-        VkCommandBufferBeginInfo begin_info{};
-        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        size_t first = draw_list.size() * job / jobs;
+        size_t count = draw_list.size() * (job + 1) / jobs - first;
+
+        auto record = [this, &secondaries, &binds, &draws, image_index, job, first, count] {
+            record_draws(secondaries[job], image_index, first, count, binds[job], draws[job]);
+        };
+
+        //the last share is recorded here while the workers do the rest
+        if (job + 1 < jobs)
+            recordings.push_back(record_pool.submit(record));
+        else
+            record();
+    }
+    for (auto &recording : recordings)
+        record_pool.wait(recording);
+
+    VkCommandBuffer command_buffer = command_buffers[current_frame];
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+        throw std::runtime_error("falied to begin recording command buffer!");
 
-        if (vkBeginCommandBuffer(command_buffers[i], &begin_info) != VK_SUCCESS)
-            throw std::runtime_error("falied to begin recording command buffer!");
+    VkRenderPassBeginInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_info.renderPass = render_pass;
+    render_pass_info.framebuffer = swap_chain_framebuffers[image_index];
+    render_pass_info.renderArea.offset = {0, 0};
+    render_pass_info.renderArea.extent = swap_chain_extent;
 
-        VkRenderPassBeginInfo render_pass_info{};
-        render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        render_pass_info.renderPass = render_pass;
-        render_pass_info.framebuffer = swap_chain_framebuffers[i];
-        render_pass_info.renderArea.offset = {0, 0};
-        render_pass_info.renderArea.extent = swap_chain_extent;
+    std::array<VkClearValue, 2> clear_values{};
+    clear_values[0].color = {{0.02f, 0.02f, 0.02f, 1.0f}};
+    clear_values[1].depthStencil = {1.0f, 0};
 
-        std::array<VkClearValue, 2> clear_values{};
-        clear_values[0].color = {{0.02f, 0.02f, 0.02f, 1.0f}};
-        clear_values[1].depthStencil = {1.0f, 0};
+    render_pass_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
+    render_pass_info.pClearValues = clear_values.data();
 
-        render_pass_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
-        render_pass_info.pClearValues = clear_values.data();
+    //nothing to draw until the background load has uploaded the mesh, the pass still clears
+    vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (jobs > 0)
+        vkCmdExecuteCommands(command_buffer, static_cast<uint32_t>(jobs), secondaries.data());
+    vkCmdEndRenderPass(command_buffer);
 
-        render_pass_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
-        render_pass_info.pClearValues = clear_values.data();
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+        throw std::runtime_error("falied torecord command buffer!");
 
-        vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
+    descriptor_binds = 0;
+    draw_calls = 0;
+    for (size_t job = 0; job < jobs; job++)
+    {
+        descriptor_binds += binds[job];
+        draw_calls += draws[job];
+    }
+
+    record_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                    std::chrono::high_resolution_clock::now() - t_start)
+                    .count();
+}
+
+/*Records the current draw list, repeated until it has at least RECORD_BENCHMARK_DRAWS draws, with
+1 to RECORD_THREADS threads and prints the average recording time of each. The command buffers
+are only recorded, never submitted, so the device is idled first and the next frame resets them.*/
+void Application::benchmark_recording()
+{
+    vkDeviceWaitIdle(device);
+
+    build_draw_list();
+    std::vector<DrawCommand> frame_draws = draw_list;
+    if (frame_draws.empty())
+        return;
 
-        VkBuffer vertex_buffers[] = {vertex_buffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(command_buffers[i], 0, 1, vertex_buffers, offsets);
-        vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT32);
-        vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &descriptor_sets[i], 0, nullptr);
+    while (draw_list.size() < RECORD_BENCHMARK_DRAWS)
+        draw_list.insert(draw_list.end(), frame_draws.begin(), frame_draws.end());
 
-        vkCmdDrawIndexed(command_buffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    std::cout << "recording " << draw_list.size() << " draws: threads, ms per frame" << std::endl;
 
-        vkCmdEndRenderPass(command_buffers[i]);
+    uint32_t saved_threads = record_threads;
+    for (record_threads = 1; record_threads <= RECORD_THREADS; record_threads++)
+    {
+        float total_ms = 0.0f;
+        for (int i = 0; i < RECORD_BENCHMARK_FRAMES; i++)
+        {
+            record_command_buffer(0);
+            total_ms += record_ms;
+        }
 
-        if (vkEndCommandBuffer(command_buffers[i]) != VK_SUCCESS)
-            throw std::runtime_error("falied torecord command buffer!");
+        std::cout << record_threads << ", " << total_ms / RECORD_BENCHMARK_FRAMES << std::endl;
     }
+
+    record_threads = saved_threads;
+    draw_list = frame_draws;
+}
+
+glm::mat4 Application::model_matrix() const
+{
+    return glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 }
 
-void Application::update_uniform_buffer(uint32_t current_image)
+//OBJ positions to world, including the 0.01 scale shader.vert applies
+glm::mat4 Application::mesh_to_world() const
+{
+    return model_matrix() * glm::scale(glm::mat4(1.0f), glm::vec3(0.01f));
+}
+
+void Application::update_uniform_buffer(uint32_t frame)
 {
     UniformBufferObject ubo{};
-    ubo.model = glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    ubo.model = model_matrix();
+    //shader.vert applies the 0.01 scale itself, shader_packed.vert leaves it and the dequantization to the model matrix
+    if (use_packed_vertices)
+        ubo.model = mesh_to_world() * mesh_bounds.dequantize();
     ubo.view = glm::lookAt(camera_pos, camera_pos + camera_forward, camera_up);
     ubo.proj = glm::perspective(glm::radians(60.0f), swap_chain_extent.width / (float)swap_chain_extent.height, 0.1f, 100.0f);
     ubo.proj[1][1] *= -1; //corrective flip
 
-    void *data;
-    vkMapMemory(device, uniform_buffers_memory[current_image], 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(device, uniform_buffers_memory[current_image]);
+    //frame - MAX_FRAMES_IN_FLIGHT was waited on, the GPU is done with this region
+    uniform_ring.begin_frame(frame);
+    uniform_ring.push(&ubo, sizeof(ubo));
+
+    if (use_meshlet_culling && mesh_ready)
+        cull_meshlets(frame, ubo.view, ubo.proj);
+}
+
+/*Meshlet bounds are in OBJ space, so the frustum planes and camera are brought into that space
+once instead of transforming every meshlet. build_draw_list leaves culled meshlets out of the
+draw list; only with multi draw indirect, where a range is one draw over its meshlets' commands,
+does a culled meshlet keep its indirect command with instanceCount 0.*/
+void Application::cull_meshlets(uint32_t frame, const glm::mat4 &view, const glm::mat4 &proj)
+{
+    glm::mat4 clip = proj * view * mesh_to_world();
+
+    //Gribb/Hartmann plane extraction, depth is zero to one
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; r++)
+        rows[r] = glm::vec4(clip[0][r], clip[1][r], clip[2][r], clip[3][r]);
+
+    glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1],
+                           rows[3] - rows[1], rows[2], rows[3] - rows[2]};
+    for (auto &plane : planes)
+        plane = plane / glm::length(glm::vec3(plane));
+
+    glm::vec3 camera = glm::vec3(glm::inverse(mesh_to_world()) * glm::vec4(camera_pos, 1.0f));
+
+    //the mesh to world scale is uniform, so OBJ space lengths over OBJ space distances project the same
+    current_lod = use_lod_chain ? select_lod(camera, 0.5f * swap_chain_extent.height * std::abs(proj[1][1])) : 0;
+    const MeshLod &lod = lods[current_lod];
+
+    VkDrawIndexedIndirectCommand *commands = reinterpret_cast<VkDrawIndexedIndirectCommand *>(indirect_buffers_memory[frame].mapped);
+
+    triangles_submitted = 0;
+    triangles_culled = 0;
+    meshlet_visible.resize(meshlets.size());
+
+    for (size_t i = 0; i < meshlets.size(); i++)
+    {
+        const Meshlet &meshlet = meshlets[i];
+
+        if (i < lod.first_meshlet || i >= lod.first_meshlet + lod.meshlet_count)
+        {
+            commands[i] = {};
+            meshlet_visible[i] = 0;
+            continue;
+        }
+
+        glm::vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+        glm::vec3 cone_axis(meshlet.cone_axis[0], meshlet.cone_axis[1], meshlet.cone_axis[2]);
+
+        bool visible = true;
+        for (const auto &plane : planes)
+        {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -meshlet.radius)
+                visible = false;
+        }
+
+        //every triangle faces away from every point of the bounding sphere
+        glm::vec3 view = center - camera;
+        if (visible && glm::dot(view, cone_axis) >= meshlet.cone_cutoff * glm::length(view) + meshlet.radius)
+            visible = false;
+
+        commands[i].indexCount = meshlet.index_count;
+        commands[i].instanceCount = visible ? 1 : 0;
+        commands[i].firstIndex = mesh_geometry.first_index + meshlet.first_index;
+        commands[i].vertexOffset = mesh_geometry.base_vertex + meshlet.vertex_offset;
+        commands[i].firstInstance = 0;
+        meshlet_visible[i] = visible;
+
+        (visible ? triangles_submitted : triangles_culled) += meshlet.index_count / 3;
+    }
+}
+
+uint32_t Application::select_lod(const glm::vec3 &camera, float pixels_per_unit) const
+{
+    float center_distance = glm::length(camera - mesh_center);
+    float distance = center_distance - mesh_radius;
+    uint32_t coarsest = static_cast<uint32_t>(lods.size() - 1);
+
+    if (lod_policy == LodPolicy::full || distance <= 0.0f)
+        return 0;
+
+    if (lod_policy == LodPolicy::screen_size)
+    {
+        float radius_pixels = pixels_per_unit * mesh_radius / center_distance;
+        float level = std::ceil(std::log2(LOD_FULL_DETAIL_RADIUS / radius_pixels));
+        return level <= 0.0f ? 0 : std::min(static_cast<uint32_t>(level), coarsest);
+    }
+
+    uint32_t level = 0;
+    while (level < coarsest && pixels_per_unit * lods[level + 1].error / distance <= LOD_ERROR_PIXELS)
+        level++;
+
+    return level;
+}
+
+void Application::start_lod_sweep()
+{
+    lod_sweep = LodSweep{};
+    lod_sweep.active = true;
+    lod_sweep.saved_policy = lod_policy;
+    lod_sweep.saved_camera_pos = camera_pos;
+
+    std::cout << "lod sweep: policy, camera distance (mesh radii), lod, triangles drawn, frame ms" << std::endl;
+    move_lod_sweep_camera();
+}
+
+//called once per frame, the first frame at every stop is left out of the averages
+void Application::step_lod_sweep()
+{
+    if (lod_sweep.frame++ > 0)
+    {
+        lod_sweep.frame_time += delta;
+        lod_sweep.triangles += triangles_submitted;
+    }
+
+    if (lod_sweep.frame <= LOD_SWEEP_FRAMES)
+        return;
+
+    std::cout << lod_policy_name(lod_policy) << ", " << lod_sweep_distance() << ", " << current_lod << ", "
+              << lod_sweep.triangles / LOD_SWEEP_FRAMES << ", " << 1000.0f * lod_sweep.frame_time / LOD_SWEEP_FRAMES << std::endl;
+
+    lod_sweep.frame = 0;
+    lod_sweep.frame_time = 0.0f;
+    lod_sweep.triangles = 0;
+
+    if (++lod_sweep.stop == LOD_SWEEP_STOPS)
+    {
+        lod_sweep.stop = 0;
+        lod_sweep.policy++;
+    }
+
+    if (lod_sweep.policy == static_cast<int>(LodPolicy::count))
+    {
+        lod_policy = lod_sweep.saved_policy;
+        camera_pos = lod_sweep.saved_camera_pos;
+        lod_sweep.active = false;
+        return;
+    }
+
+    move_lod_sweep_camera();
+}
+
+//distance from the mesh center in mesh radii, starting half a radius outside and doubling that gap every stop
+float Application::lod_sweep_distance() const
+{
+    return 1.0f + 0.5f * (1 << lod_sweep.stop);
+}
+
+void Application::move_lod_sweep_camera()
+{
+    glm::vec3 center = glm::vec3(mesh_to_world() * glm::vec4(mesh_center, 1.0f));
+
+    lod_policy = static_cast<LodPolicy>(lod_sweep.policy);
+    camera_pos = center - 0.01f * mesh_radius * lod_sweep_distance() * camera_forward;
 }
 
 void Application::draw_frame()
 {
-    vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+    //frame N only waits for N - MAX_FRAMES_IN_FLIGHT, whose per-frame resources it is about to reuse
+    uint64_t frame = frame_number + 1;
+    auto t_wait = std::chrono::high_resolution_clock::now();
+    if (frame > MAX_FRAMES_IN_FLIGHT)
+        wait_timeline(device, frame_timeline, frame - MAX_FRAMES_IN_FLIGHT);
+    blocked_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                     std::chrono::high_resolution_clock::now() - t_wait)
+                     .count();
+    blocked_ms_sum += blocked_ms;
+    blocked_frames++;
+
+    if (!retired_swap_chains.empty())
+        destroy_retired_swap_chains(timeline_value(device, frame_timeline));
+    if (!retired_pipelines.empty())
+        destroy_retired_pipelines(timeline_value(device, frame_timeline));
+
+    //the last frame that bound this frame's material sets has retired, so textures can be swapped in
+    if (!material_writes.empty())
+    {
+        for (size_t material : material_writes[current_frame])
+            write_material_descriptor(current_frame, material, texture_image_views[material]);
+        material_writes[current_frame].clear();
+    }
 
     uint32_t image_index;
     VkResult result = vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX, image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);
@@ -1313,37 +2695,66 @@ void Application::draw_frame()
         throw std::runtime_error("failed to aquire swap chain image!");
     }
 
-    if (images_in_flight[image_index] != VK_NULL_HANDLE)
-        vkWaitForFences(device, 1, &images_in_flight[image_index], VK_TRUE, UINT64_MAX);
+    //frame_number is the last frame that can have drawn with pipelines a reload just replaced
+    pipelines.poll();
+    std::vector<VkPipeline> replaced = pipelines.take_retired();
+    for (VkPipeline pipeline : replaced)
+        retired_pipelines.push_back({frame_number, pipeline});
+    if (shader_swap_pending && !replaced.empty())
+    {
+        shader_swap_pending = false;
+        float reload_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                              std::chrono::high_resolution_clock::now() - shader_change_time)
+                              .count();
+        std::cout << "shaders: reloaded " << replaced.size() << " pipelines " << reload_ms << " ms after the change" << std::endl;
+    }
+
+    update_uniform_buffer(static_cast<uint32_t>(current_frame));
+    build_draw_list();
+    record_command_buffer(image_index);
 
-    images_in_flight[image_index] = in_flight_fences[current_frame];
+    //uploads chain in on the GPU, flush() makes sure their acquires are submitted before this waits on them
+    std::vector<VkSemaphore> wait_semaphores = {image_available_semaphores[current_frame]};
+    std::vector<VkPipelineStageFlags> wait_stages = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    std::vector<uint64_t> wait_values = {0}; //ignored for binary semaphores
+    if (upload_dependency != 0)
+    {
+        staging_ring.flush(upload_dependency);
+        wait_semaphores.push_back(staging_ring.timeline());
+        wait_stages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+        wait_values.push_back(upload_dependency);
+        upload_dependency = 0;
+    }
 
-    update_uniform_buffer(image_index);
+    VkSemaphore signal_semaphores[] = {render_finished_semaphores[current_frame], frame_timeline};
+    uint64_t signal_values[] = {0, frame};
+
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size());
+    timeline_info.pWaitSemaphoreValues = wait_values.data();
+    timeline_info.signalSemaphoreValueCount = 2;
+    timeline_info.pSignalSemaphoreValues = signal_values;
 
     VkSubmitInfo submit_info{};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-    VkSemaphore waitSemaphores[] = {image_available_semaphores[current_frame]};
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = waitSemaphores;
-    submit_info.pWaitDstStageMask = waitStages;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = static_cast<uint32_t>(wait_semaphores.size());
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffers[image_index];
-
-    VkSemaphore signal_semaphores[] = {render_finished_semaphores[current_frame]};
-    submit_info.signalSemaphoreCount = 1;
+    submit_info.pCommandBuffers = &command_buffers[current_frame];
+    submit_info.signalSemaphoreCount = 2;
     submit_info.pSignalSemaphores = signal_semaphores;
 
-    vkResetFences(device, 1, &in_flight_fences[current_frame]);
-
-    if (vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fences[current_frame]) != VK_SUCCESS)
+    if (vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
         throw std::runtime_error("failed to submit draw command buffer!");
+    frame_number = frame;
 
     VkPresentInfoKHR present_info{};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     present_info.waitSemaphoreCount = 1;
-    present_info.pWaitSemaphores = signal_semaphores;
+    present_info.pWaitSemaphores = &render_finished_semaphores[current_frame];
 
     VkSwapchainKHR swap_chains[] = {swap_chain};
     present_info.swapchainCount = 1;
@@ -1368,39 +2779,20 @@ void Application::create_sync_objects()
 {
     image_available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
     render_finished_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
-    images_in_flight.resize(swap_chain_images.size(), VK_NULL_HANDLE);
 
     VkSemaphoreCreateInfo semaphore_info{};
     semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    VkFenceCreateInfo fence_info{};
-    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         if (vkCreateSemaphore(device, &semaphore_info, nullptr, &image_available_semaphores[i]) != VK_SUCCESS ||
-            vkCreateSemaphore(device, &semaphore_info, nullptr, &render_finished_semaphores[i]) != VK_SUCCESS ||
-            vkCreateFence(device, &fence_info, nullptr, &in_flight_fences[i]) != VK_SUCCESS)
+            vkCreateSemaphore(device, &semaphore_info, nullptr, &render_finished_semaphores[i]) != VK_SUCCESS)
         {
             throw std::runtime_error("failed to create synchronization objects for a frame!");
         }
     }
-}
 
-VkShaderModule Application::create_shader_module(const std::vector<char> &code)
-{
-    VkShaderModuleCreateInfo create_info{};
-    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    create_info.codeSize = code.size();
-    create_info.pCode = reinterpret_cast<const uint32_t *>(code.data());
-
-    VkShaderModule shader_module;
-    if (vkCreateShaderModule(device, &create_info, nullptr, &shader_module) != VK_SUCCESS)
-        throw std::runtime_error("failed to create shader module!");
-
-    return shader_module;
+    frame_timeline = create_timeline_semaphore(device, 0);
 }
 
 VkSurfaceFormatKHR Application::choose_swap_surface_format(const std::vector<VkSurfaceFormatKHR> &available_formats)
@@ -1551,5 +2943,8 @@ std::vector<const char *> Application::get_required_extensions()
     if (enable_validation_layers)
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
+    //required by VK_KHR_timeline_semaphore on Vulkan 1.0
+    extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
     return extensions;
 }
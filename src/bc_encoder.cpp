@@ -0,0 +1,370 @@
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BC_ENCODER_AVX2 1
+#endif
+
+/*index[i] = round(dot(texel[i] - base, axis) * (levels - 1) / dot(axis, axis)), clamped to
+[0, levels - 1]. Every kernel does the dot in integers and the scale in float so they agree bit
+for bit.*/
+typedef void (*ProjectFunction)(const uint8_t *texels, const int32_t *base, const int32_t *axis, int32_t levels, uint8_t *indices);
+
+static float projection_scale(const int32_t *axis, int32_t levels)
+{
+    int32_t length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3];
+    return length > 0 ? float(levels - 1) / float(length) : 0.0f;
+}
+
+#ifndef __SSE2__
+static void project_scalar(const uint8_t *texels, const int32_t *base, const int32_t *axis, int32_t levels, uint8_t *indices)
+{
+    float scale = projection_scale(axis, levels);
+
+    for (int i = 0; i < 16; i++)
+    {
+        int32_t dot = 0;
+        for (int c = 0; c < 4; c++)
+            dot += (texels[4 * i + c] - base[c]) * axis[c];
+
+        int32_t index = static_cast<int32_t>(float(dot) * scale + 0.5f);
+        indices[i] = static_cast<uint8_t>(std::min(std::max(index, 0), levels - 1));
+    }
+}
+#endif
+
+#ifdef __SSE2__
+static void project_sse2(const uint8_t *texels, const int32_t *base, const int32_t *axis, int32_t levels, uint8_t *indices)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i base16 = _mm_setr_epi16(base[0], base[1], base[2], base[3], base[0], base[1], base[2], base[3]);
+    const __m128i axis16 = _mm_setr_epi16(axis[0], axis[1], axis[2], axis[3], axis[0], axis[1], axis[2], axis[3]);
+    const __m128i max_index = _mm_set1_epi16(static_cast<int16_t>(levels - 1));
+    const __m128 scale = _mm_set1_ps(projection_scale(axis, levels));
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    for (int i = 0; i < 16; i += 4)
+    {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(texels + 4 * i));
+
+        //madd leaves two partial sums per texel, (r, g) and (b, a)
+        __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(p, zero), base16), axis16));
+        __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(p, zero), base16), axis16));
+        __m128i dot = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                    _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+
+        __m128i index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(dot), scale), half));
+
+        //no 32 bit min/max before SSE4.1, clamp after narrowing
+        __m128i index16 = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(index, index), zero), max_index);
+        int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(index16, index16));
+        memcpy(indices + i, &packed, 4);
+    }
+}
+#endif
+
+#ifdef BC_ENCODER_AVX2
+__attribute__((target("avx2"))) static void project_avx2(const uint8_t *texels, const int32_t *base, const int32_t *axis, int32_t levels, uint8_t *indices)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i base16 = _mm256_setr_epi16(base[0], base[1], base[2], base[3], base[0], base[1], base[2], base[3],
+                                             base[0], base[1], base[2], base[3], base[0], base[1], base[2], base[3]);
+    const __m256i axis16 = _mm256_setr_epi16(axis[0], axis[1], axis[2], axis[3], axis[0], axis[1], axis[2], axis[3],
+                                             axis[0], axis[1], axis[2], axis[3], axis[0], axis[1], axis[2], axis[3]);
+    const __m256i max_index = _mm256_set1_epi32(levels - 1);
+    const __m256 scale = _mm256_set1_ps(projection_scale(axis, levels));
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    for (int i = 0; i < 16; i += 8)
+    {
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(texels + 4 * i));
+
+        //unpacks stay within 128 bit lanes: lo holds texels 0, 1 | 4, 5 and hi 2, 3 | 6, 7
+        __m256i lo = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_unpacklo_epi8(p, zero), base16), axis16);
+        __m256i hi = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_unpackhi_epi8(p, zero), base16), axis16);
+        __m256i dot = _mm256_hadd_epi32(lo, hi); //back in texel order 0..3 | 4..7
+
+        __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(dot), scale), half));
+        index = _mm256_min_epi32(_mm256_max_epi32(index, zero), max_index);
+
+        __m128i index16 = _mm_packs_epi32(_mm256_castsi256_si128(index), _mm256_extracti128_si256(index, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(indices + i), _mm_packus_epi16(index16, index16));
+    }
+}
+#endif
+
+static ProjectFunction select_projection(const char **name)
+{
+#ifdef BC_ENCODER_AVX2
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *name = "avx2";
+        return project_avx2;
+    }
+#endif
+#ifdef __SSE2__
+    *name = "sse2";
+    return project_sse2;
+#else
+    *name = "scalar";
+    return project_scalar;
+#endif
+}
+
+static const char *projection_name = nullptr;
+static const ProjectFunction project = select_projection(&projection_name);
+
+const char *bc_encoder_kernel()
+{
+    return projection_name;
+}
+
+bool has_alpha(const uint8_t *rgba, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+        if (rgba[4 * i + 3] != 255)
+            return true;
+    }
+    return false;
+}
+
+/*Per channel bounding box, with red, blue and alpha flipped when they fall while green rises so
+the endpoints follow the block's main diagonal instead of always min -> max. Inset by 1/16 of the
+range, the extremes are rarely worth an endpoint.*/
+static void bounding_endpoints(const uint8_t *texels, int channels, int32_t *e0, int32_t *e1)
+{
+    int32_t lo[4] = {255, 255, 255, 255};
+    int32_t hi[4] = {0, 0, 0, 0};
+
+#ifdef __SSE2__
+    //four texels per register, then fold the four lanes onto one texel
+    __m128i lo8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(texels));
+    __m128i hi8 = lo8;
+    for (int i = 1; i < 4; i++)
+    {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(texels + 16 * i));
+        lo8 = _mm_min_epu8(lo8, p);
+        hi8 = _mm_max_epu8(hi8, p);
+    }
+    lo8 = _mm_min_epu8(lo8, _mm_shuffle_epi32(lo8, _MM_SHUFFLE(1, 0, 3, 2)));
+    hi8 = _mm_max_epu8(hi8, _mm_shuffle_epi32(hi8, _MM_SHUFFLE(1, 0, 3, 2)));
+    lo8 = _mm_min_epu8(lo8, _mm_shuffle_epi32(lo8, _MM_SHUFFLE(2, 3, 0, 1)));
+    hi8 = _mm_max_epu8(hi8, _mm_shuffle_epi32(hi8, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    uint32_t lo_packed = _mm_cvtsi128_si32(lo8);
+    uint32_t hi_packed = _mm_cvtsi128_si32(hi8);
+    for (int c = 0; c < channels; c++)
+    {
+        lo[c] = (lo_packed >> (8 * c)) & 255;
+        hi[c] = (hi_packed >> (8 * c)) & 255;
+    }
+#else
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            lo[c] = std::min<int32_t>(lo[c], texels[4 * i + c]);
+            hi[c] = std::max<int32_t>(hi[c], texels[4 * i + c]);
+        }
+    }
+#endif
+
+    int32_t covariance[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        int32_t g = 2 * texels[4 * i + 1] - lo[1] - hi[1];
+        for (int c = 0; c < channels; c++)
+            covariance[c] += (2 * texels[4 * i + c] - lo[c] - hi[c]) * g;
+    }
+
+    for (int c = 0; c < 4; c++)
+    {
+        if (c >= channels)
+        {
+            e0[c] = e1[c] = 0;
+            continue;
+        }
+
+        int32_t inset = (hi[c] - lo[c]) / 16;
+        e0[c] = hi[c] - inset;
+        e1[c] = lo[c] + inset;
+
+        if (covariance[c] < 0)
+            std::swap(e0[c], e1[c]);
+    }
+}
+
+static uint16_t pack_565(const int32_t *color)
+{
+    return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+}
+
+static void unpack_565(uint16_t packed, int32_t *color)
+{
+    int32_t r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+    color[3] = 0;
+}
+
+void encode_bc1_block(const uint8_t *texels, uint8_t *block)
+{
+    int32_t e0[4], e1[4];
+    bounding_endpoints(texels, 3, e0, e1);
+
+    uint16_t c0 = pack_565(e0);
+    uint16_t c1 = pack_565(e1);
+
+    //four colour mode needs c0 > c1, equal endpoints are a flat block
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t bits = 0;
+    if (c0 != c1)
+    {
+        int32_t d0[4], d1[4], axis[4];
+        unpack_565(c0, d0);
+        unpack_565(c1, d1);
+        for (int c = 0; c < 4; c++)
+            axis[c] = d1[c] - d0[c];
+
+        uint8_t steps[16];
+        project(texels, d0, axis, 4, steps);
+
+        //steps from c0 towards c1 in palette order: c0, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1, c1
+        const uint32_t palette_index[4] = {0, 2, 3, 1};
+        for (int i = 0; i < 16; i++)
+            bits |= palette_index[steps[i]] << (2 * i);
+    }
+
+    memcpy(block, &c0, 2);
+    memcpy(block + 2, &c1, 2);
+    memcpy(block + 4, &bits, 4);
+}
+
+struct BitWriter
+{
+    uint64_t words[2] = {0, 0};
+    uint32_t position = 0;
+
+    void write(uint32_t value, uint32_t count)
+    {
+        uint32_t shift = position % 64;
+        words[position / 64] |= uint64_t(value) << shift;
+        if (shift + count > 64)
+            words[position / 64 + 1] |= uint64_t(value) >> (64 - shift);
+        position += count;
+    }
+};
+
+//7 bit endpoint plus the p-bit that reconstructs it best, the endpoint decodes to (q << 1) | p
+static void quantize_7777_1(const int32_t *endpoint, int32_t *quantized, int32_t &pbit, int32_t *decoded)
+{
+    int32_t best_error = INT32_MAX;
+
+    for (int32_t p = 0; p < 2; p++)
+    {
+        int32_t q[4], error = 0;
+        for (int c = 0; c < 4; c++)
+        {
+            q[c] = std::min(std::max((endpoint[c] - p + 1) >> 1, 0), 127);
+            int32_t d = ((q[c] << 1) | p) - endpoint[c];
+            error += d * d;
+        }
+
+        if (error < best_error)
+        {
+            best_error = error;
+            pbit = p;
+            for (int c = 0; c < 4; c++)
+            {
+                quantized[c] = q[c];
+                decoded[c] = (q[c] << 1) | p;
+            }
+        }
+    }
+}
+
+void encode_bc7_block(const uint8_t *texels, uint8_t *block)
+{
+    int32_t e0[4], e1[4];
+    bounding_endpoints(texels, 4, e0, e1);
+
+    int32_t q0[4], q1[4], d0[4], d1[4], p0, p1;
+    quantize_7777_1(e0, q0, p0, d0);
+    quantize_7777_1(e1, q1, p1, d1);
+
+    int32_t axis[4];
+    for (int c = 0; c < 4; c++)
+        axis[c] = d1[c] - d0[c];
+
+    uint8_t indices[16];
+    project(texels, d0, axis, 16, indices);
+
+    //texel 0's index is stored without its top bit, so it has to be below 8
+    if (indices[0] >= 8)
+    {
+        std::swap(q0, q1);
+        std::swap(p0, p1);
+        for (int i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    BitWriter writer;
+    writer.write(1 << 6, 7); //mode 6
+    for (int c = 0; c < 4; c++)
+    {
+        writer.write(q0[c], 7);
+        writer.write(q1[c], 7);
+    }
+    writer.write(p0, 1);
+    writer.write(p1, 1);
+
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        writer.write(indices[i], 4);
+
+    memcpy(block, writer.words, 16);
+}
+
+void encode_bc_rows(const uint8_t *rgba, uint32_t width, uint32_t height, bool bc7,
+                    uint32_t first_row, uint32_t row_count, uint8_t *blocks)
+{
+    uint32_t blocks_x = (width + 3) / 4;
+    uint32_t block_size = bc7 ? BC7_BLOCK_SIZE : BC1_BLOCK_SIZE;
+    uint8_t texels[64];
+
+    for (uint32_t by = first_row; by < first_row + row_count; by++)
+    {
+        for (uint32_t bx = 0; bx < blocks_x; bx++)
+        {
+            for (uint32_t y = 0; y < 4; y++)
+            {
+                const uint8_t *row = rgba + size_t(std::min(4 * by + y, height - 1)) * width * 4;
+
+                if (4 * bx + 4 <= width)
+                    memcpy(texels + 16 * y, row + 16 * bx, 16);
+                else
+                {
+                    for (uint32_t x = 0; x < 4; x++)
+                        memcpy(texels + 16 * y + 4 * x, row + 4 * std::min(4 * bx + x, width - 1), 4);
+                }
+            }
+
+            uint8_t *block = blocks + (size_t(by) * blocks_x + bx) * block_size;
+            if (bc7)
+                encode_bc7_block(texels, block);
+            else
+                encode_bc1_block(texels, block);
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#include "geometry_arena.h"
+
+#include <iterator>
+#include <stdexcept>
+
+void GeometryArena::create(VkBuffer buffer, VkDeviceSize size)
+{
+    arena_buffer = buffer;
+    arena_size = size;
+    used_bytes = 0;
+
+    free_ranges.clear();
+    free_ranges[0] = size;
+}
+
+void GeometryArena::destroy()
+{
+    arena_buffer = VK_NULL_HANDLE;
+    arena_size = 0;
+    used_bytes = 0;
+    free_ranges.clear();
+}
+
+GeometryAllocation GeometryArena::allocate(uint32_t vertex_count, VkDeviceSize vertex_stride, uint32_t index_count, VkDeviceSize index_stride)
+{
+    GeometryAllocation allocation{};
+    allocation.vertex_size = vertex_count * vertex_stride;
+    allocation.index_size = index_count * index_stride;
+    allocation.vertex_offset = allocate_range(allocation.vertex_size, vertex_stride);
+
+    try
+    {
+        allocation.index_offset = allocate_range(allocation.index_size, index_stride);
+    }
+    catch (...)
+    {
+        free_range(allocation.vertex_offset, allocation.vertex_size);
+        throw;
+    }
+
+    allocation.base_vertex = static_cast<int32_t>(allocation.vertex_offset / vertex_stride);
+    allocation.first_index = static_cast<uint32_t>(allocation.index_offset / index_stride);
+
+    return allocation;
+}
+
+void GeometryArena::free(GeometryAllocation &allocation)
+{
+    if (allocation.vertex_size > 0)
+        free_range(allocation.vertex_offset, allocation.vertex_size);
+    if (allocation.index_size > 0)
+        free_range(allocation.index_offset, allocation.index_size);
+
+    allocation = GeometryAllocation{};
+}
+
+//alignment doesn't have to be a power of two, vertex strides usually aren't
+VkDeviceSize GeometryArena::allocate_range(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (size == 0)
+        return 0;
+
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it)
+    {
+        VkDeviceSize range_offset = it->first;
+        VkDeviceSize range_end = it->first + it->second;
+        VkDeviceSize offset = (range_offset + alignment - 1) / alignment * alignment;
+        if (offset + size > range_end)
+            continue;
+
+        //the padding before offset and whatever is left after it stay free
+        free_ranges.erase(it);
+        if (offset > range_offset)
+            free_ranges[range_offset] = offset - range_offset;
+        if (offset + size < range_end)
+            free_ranges[offset + size] = range_end - offset - size;
+
+        used_bytes += size;
+        return offset;
+    }
+
+    throw std::runtime_error("geometry arena is full!");
+}
+
+void GeometryArena::free_range(VkDeviceSize offset, VkDeviceSize size)
+{
+    used_bytes -= size;
+
+    auto next = free_ranges.lower_bound(offset);
+    if (next != free_ranges.end() && next->first == offset + size)
+    {
+        size += next->second;
+        next = free_ranges.erase(next);
+    }
+
+    if (next != free_ranges.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset)
+        {
+            prev->second += size;
+            return;
+        }
+    }
+
+    free_ranges[offset] = size;
+}
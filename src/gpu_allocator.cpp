@@ -0,0 +1,422 @@
+#include "gpu_allocator.h"
+
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+const uint32_t TLSF_SL_BITS = 4;
+const uint32_t TLSF_SL_COUNT = 1 << TLSF_SL_BITS;
+const uint32_t TLSF_FL_COUNT = 32;
+const VkDeviceSize TLSF_GRANULE = 256; //every range is a multiple of it, offsets too
+
+const uint32_t NO_NODE = UINT32_MAX;
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+//first level: power of two of the size in granules, second level: which sixteenth of that range
+static void tlsf_mapping(VkDeviceSize size, uint32_t &fl, uint32_t &sl)
+{
+    uint64_t granules = size / TLSF_GRANULE;
+    fl = 63 - __builtin_clzll(granules);
+    sl = static_cast<uint32_t>((granules << TLSF_SL_BITS) >> fl) - TLSF_SL_COUNT;
+}
+
+struct GpuBlock
+{
+    struct Node
+    {
+        VkDeviceSize offset;
+        VkDeviceSize size; //0 for nodes on the unused list
+        uint32_t prev_physical;
+        uint32_t next_physical;
+        uint32_t prev_free;
+        uint32_t next_free;
+        bool free;
+    };
+
+    VkDeviceMemory memory;
+    uint8_t *mapped;
+    VkDeviceSize size;
+    VkDeviceSize used = 0;
+    uint32_t allocations = 0;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> unused_nodes;
+    uint32_t fl_bitmap = 0;
+    uint32_t sl_bitmap[TLSF_FL_COUNT] = {};
+    uint32_t heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+    GpuBlock(VkDeviceMemory memory, uint8_t *mapped, VkDeviceSize size)
+        : memory(memory), mapped(mapped), size(size)
+    {
+        std::fill(&heads[0][0], &heads[0][0] + TLSF_FL_COUNT * TLSF_SL_COUNT, NO_NODE);
+        insert(new_node(0, size, NO_NODE, NO_NODE));
+    }
+
+    uint32_t new_node(VkDeviceSize offset, VkDeviceSize node_size, uint32_t prev_physical, uint32_t next_physical)
+    {
+        uint32_t node;
+        if (unused_nodes.empty())
+        {
+            node = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({});
+        }
+        else
+        {
+            node = unused_nodes.back();
+            unused_nodes.pop_back();
+        }
+
+        nodes[node] = {offset, node_size, prev_physical, next_physical, NO_NODE, NO_NODE, false};
+        return node;
+    }
+
+    void release_node(uint32_t node)
+    {
+        nodes[node].size = 0;
+        unused_nodes.push_back(node);
+    }
+
+    void insert(uint32_t node)
+    {
+        uint32_t fl, sl;
+        tlsf_mapping(nodes[node].size, fl, sl);
+
+        uint32_t head = heads[fl][sl];
+        nodes[node].free = true;
+        nodes[node].prev_free = NO_NODE;
+        nodes[node].next_free = head;
+        if (head != NO_NODE)
+            nodes[head].prev_free = node;
+
+        heads[fl][sl] = node;
+        fl_bitmap |= 1u << fl;
+        sl_bitmap[fl] |= 1u << sl;
+    }
+
+    void remove(uint32_t node)
+    {
+        uint32_t fl, sl;
+        tlsf_mapping(nodes[node].size, fl, sl);
+
+        Node &n = nodes[node];
+        if (n.prev_free != NO_NODE)
+            nodes[n.prev_free].next_free = n.next_free;
+        else
+            heads[fl][sl] = n.next_free;
+        if (n.next_free != NO_NODE)
+            nodes[n.next_free].prev_free = n.prev_free;
+
+        if (heads[fl][sl] == NO_NODE)
+        {
+            sl_bitmap[fl] &= ~(1u << sl);
+            if (sl_bitmap[fl] == 0)
+                fl_bitmap &= ~(1u << fl);
+        }
+
+        n.free = false;
+    }
+
+    //cuts node after first_size bytes, the new node after it is returned
+    uint32_t split(uint32_t node, VkDeviceSize first_size)
+    {
+        uint32_t next = nodes[node].next_physical;
+        uint32_t rest = new_node(nodes[node].offset + first_size, nodes[node].size - first_size, node, next);
+
+        nodes[node].size = first_size;
+        nodes[node].next_physical = rest;
+        if (next != NO_NODE)
+            nodes[next].prev_physical = rest;
+
+        return rest;
+    }
+
+    //absorbs node's physical successor, which must be free and already removed from its bin
+    void merge_next(uint32_t node)
+    {
+        uint32_t next = nodes[node].next_physical;
+        uint32_t after = nodes[next].next_physical;
+
+        nodes[node].size += nodes[next].size;
+        nodes[node].next_physical = after;
+        if (after != NO_NODE)
+            nodes[after].prev_physical = node;
+
+        release_node(next);
+    }
+
+    uint32_t allocate(VkDeviceSize request, VkDeviceSize alignment)
+    {
+        //room for the worst case front padding, rounded up to the next bin so any node in it fits
+        VkDeviceSize search = request + (alignment - TLSF_GRANULE);
+        if (search > size)
+            return NO_NODE;
+
+        uint32_t fl, sl;
+        tlsf_mapping(search, fl, sl);
+        if (fl >= TLSF_SL_BITS)
+        {
+            search += (VkDeviceSize(1) << (fl - TLSF_SL_BITS)) * TLSF_GRANULE - TLSF_GRANULE;
+            tlsf_mapping(search, fl, sl);
+        }
+
+        uint32_t sl_map = fl < TLSF_FL_COUNT ? sl_bitmap[fl] & (~0u << sl) : 0;
+        if (sl_map == 0)
+        {
+            uint32_t fl_map = fl + 1 < TLSF_FL_COUNT ? fl_bitmap & (~0u << (fl + 1)) : 0;
+            if (fl_map == 0)
+                return NO_NODE;
+
+            fl = __builtin_ctz(fl_map);
+            sl_map = sl_bitmap[fl];
+        }
+        sl = __builtin_ctz(sl_map);
+
+        uint32_t node = heads[fl][sl];
+        remove(node);
+
+        VkDeviceSize padding = align_up(nodes[node].offset, alignment) - nodes[node].offset;
+        if (padding != 0)
+        {
+            uint32_t aligned = split(node, padding);
+            insert(node);
+            node = aligned;
+        }
+
+        if (nodes[node].size > request)
+            insert(split(node, request));
+
+        used += nodes[node].size;
+        allocations++;
+        return node;
+    }
+
+    void free(uint32_t node)
+    {
+        used -= nodes[node].size;
+        allocations--;
+
+        uint32_t next = nodes[node].next_physical;
+        if (next != NO_NODE && nodes[next].free)
+        {
+            remove(next);
+            merge_next(node);
+        }
+
+        uint32_t prev = nodes[node].prev_physical;
+        if (prev != NO_NODE && nodes[prev].free)
+        {
+            remove(prev);
+            merge_next(prev);
+            node = prev;
+        }
+
+        insert(node);
+    }
+};
+
+GpuAllocator::GpuAllocator() = default;
+GpuAllocator::~GpuAllocator() = default;
+
+void GpuAllocator::create(VkPhysicalDevice physical_device, VkDevice device)
+{
+    this->device = device;
+
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    buffer_image_granularity = properties.limits.bufferImageGranularity;
+    max_allocations = properties.limits.maxMemoryAllocationCount;
+
+    //an eighth of the heap at most, so small heaps (host visible device local windows) aren't swallowed by one block
+    block_sizes.resize(memory_properties.memoryTypeCount);
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+    {
+        VkDeviceSize heap_size = memory_properties.memoryHeaps[memory_properties.memoryTypes[i].heapIndex].size;
+        block_sizes[i] = std::max(std::min(GPU_BLOCK_SIZE, heap_size / 8) / TLSF_GRANULE * TLSF_GRANULE, TLSF_GRANULE);
+    }
+
+    pools.resize(memory_properties.memoryTypeCount * 2);
+}
+
+void GpuAllocator::destroy()
+{
+    for (auto &pool : pools)
+    {
+        for (auto &block : pool)
+            vkFreeMemory(device, block->memory, nullptr);
+        pool.clear();
+    }
+
+    device_allocations = 0;
+}
+
+uint32_t GpuAllocator::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+    {
+        if ((type_filter & (1 << i)) &&
+            (memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+VkDeviceMemory GpuAllocator::allocate_memory(uint32_t memory_type, VkDeviceSize size, uint8_t **mapped)
+{
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = memory_type;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &alloc_info, nullptr, &memory) != VK_SUCCESS)
+        throw std::runtime_error("failed to allocate gpu memory!");
+    device_allocations++;
+
+    *mapped = nullptr;
+    if (memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        void *data;
+        if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+            throw std::runtime_error("failed to map gpu memory!");
+        *mapped = static_cast<uint8_t *>(data);
+    }
+
+    return memory;
+}
+
+GpuAllocation GpuAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+    uint32_t memory_type = find_memory_type(requirements.memoryTypeBits, properties);
+    VkDeviceSize block_size = block_sizes[memory_type];
+
+    GpuAllocation allocation;
+
+    if (requirements.size > block_size / 2 || (!linear && requirements.size >= GPU_DEDICATED_IMAGE_SIZE))
+    {
+        allocation.memory = allocate_memory(memory_type, requirements.size, &allocation.mapped);
+        allocation.size = requirements.size;
+        dedicated_allocations++;
+        dedicated_bytes += requirements.size;
+        return allocation;
+    }
+
+    allocation.pool = memory_type * 2 + (!linear && buffer_image_granularity > 1 ? 1 : 0);
+    auto &pool = pools[allocation.pool];
+
+    VkDeviceSize size = align_up(requirements.size, TLSF_GRANULE);
+    VkDeviceSize alignment = std::max(requirements.alignment, TLSF_GRANULE);
+
+    for (auto &block : pool)
+    {
+        uint32_t node = block->allocate(size, alignment);
+        if (node == NO_NODE)
+            continue;
+
+        allocation.block = block.get();
+        allocation.node = node;
+        break;
+    }
+
+    if (allocation.block == nullptr)
+    {
+        uint8_t *mapped;
+        VkDeviceMemory memory = allocate_memory(memory_type, block_size, &mapped);
+        pool.push_back(std::make_unique<GpuBlock>(memory, mapped, block_size));
+
+        allocation.block = pool.back().get();
+        allocation.node = allocation.block->allocate(size, alignment);
+        if (allocation.node == NO_NODE)
+            throw std::runtime_error("failed to sub-allocate gpu memory!");
+    }
+
+    const GpuBlock::Node &node = allocation.block->nodes[allocation.node];
+    allocation.memory = allocation.block->memory;
+    allocation.offset = node.offset;
+    allocation.size = node.size;
+    if (allocation.block->mapped)
+        allocation.mapped = allocation.block->mapped + node.offset;
+
+    return allocation;
+}
+
+void GpuAllocator::free(GpuAllocation &allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    if (allocation.block == nullptr)
+    {
+        vkFreeMemory(device, allocation.memory, nullptr);
+        device_allocations--;
+        dedicated_allocations--;
+        dedicated_bytes -= allocation.size;
+    }
+    else
+    {
+        allocation.block->free(allocation.node);
+
+        //empty blocks go back to the driver, except the last one of each pool
+        auto &pool = pools[allocation.pool];
+        if (allocation.block->allocations == 0 && pool.size() > 1)
+        {
+            vkFreeMemory(device, allocation.block->memory, nullptr);
+            device_allocations--;
+            pool.erase(std::find_if(pool.begin(), pool.end(), [&](const std::unique_ptr<GpuBlock> &block) {
+                return block.get() == allocation.block;
+            }));
+        }
+    }
+
+    allocation = GpuAllocation{};
+}
+
+std::string GpuAllocator::stats() const
+{
+    size_t blocks = 0;
+    uint32_t allocations = dedicated_allocations;
+    VkDeviceSize block_bytes = 0, used = 0, free_bytes = 0, largest_free = 0, usable_free = 0;
+    size_t free_ranges = 0;
+
+    for (const auto &pool : pools)
+    {
+        for (const auto &block : pool)
+        {
+            blocks++;
+            allocations += block->allocations;
+            block_bytes += block->size;
+            used += block->used;
+
+            VkDeviceSize block_largest = 0;
+            for (const GpuBlock::Node &node : block->nodes)
+            {
+                if (node.size == 0 || !node.free)
+                    continue;
+                free_ranges++;
+                free_bytes += node.size;
+                block_largest = std::max(block_largest, node.size);
+            }
+            largest_free = std::max(largest_free, block_largest);
+            usable_free += block_largest;
+        }
+    }
+
+    //share of each block's free space outside its largest free range, 0 when every block has a single one
+    float fragmentation = free_bytes ? 100.0f * (1.0f - float(usable_free) / float(free_bytes)) : 0.0f;
+
+    std::stringstream ss;
+    ss << "gpu memory: " << allocations << " allocations in " << device_allocations << " vkAllocateMemory (limit "
+       << max_allocations << "), " << blocks << " blocks + " << dedicated_allocations << " dedicated, "
+       << used / (1024.0f * 1024.0f) << " of " << block_bytes / (1024.0f * 1024.0f) << " MB block memory used + "
+       << dedicated_bytes / (1024.0f * 1024.0f) << " MB dedicated, " << free_ranges << " free ranges (largest "
+       << largest_free / (1024.0f * 1024.0f) << " MB, fragmentation " << fragmentation << "%)";
+    return ss.str();
+}
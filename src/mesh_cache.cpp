@@ -0,0 +1,335 @@
+#include "mesh_cache.h"
+#include "hash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;
+    int64_t source_mtime; //ns
+    uint64_t source_hash;
+    uint64_t path_hash;
+    uint64_t config; //fingerprint of the settings load_model ran with
+    uint32_t section_count;
+    uint32_t reserved;
+};
+
+//one per dependency in the dependencies section, followed by the path padded to 8 bytes
+struct DependencyEntry
+{
+    uint64_t size;
+    int64_t mtime; //ns
+    uint64_t hash;
+    uint32_t path_size;
+    uint32_t missing;
+};
+
+const char MESH_CACHE_MAGIC[4] = {'V', 'K', 'M', 'C'};
+const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint64_t path_hash(const std::string &source_path)
+{
+    return hash_bytes(source_path.data(), source_path.size());
+}
+
+static std::string cache_path(const std::string &source_path)
+{
+    std::stringstream ss;
+    ss << MESH_CACHE_DIR << "/" << std::hex << path_hash(source_path) << ".mesh";
+    return ss.str();
+}
+
+static bool stat_source(const std::string &source_path, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(source_path.c_str(), &st) != 0)
+        return false;
+
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+static bool hash_source(const std::string &source_path, uint64_t &hash)
+{
+    int fd = ::open(source_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0)
+    {
+        ::close(fd);
+        hash = hash_bytes(nullptr, 0);
+        return true;
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    hash = hash_bytes(data, size);
+    munmap(data, size);
+    return true;
+}
+
+MeshCache::~MeshCache()
+{
+    close();
+}
+
+bool MeshCache::open(const std::string &source_path, uint64_t config)
+{
+    close();
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!stat_source(source_path, source_size, source_mtime))
+        return false;
+
+    int fd = ::open(cache_path(source_path).c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MeshCacheHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    mapping = data;
+    mapping_size = static_cast<size_t>(st.st_size);
+
+    const MeshCacheHeader *header = static_cast<const MeshCacheHeader *>(mapping);
+    uint64_t table_end = sizeof(MeshCacheHeader) + uint64_t(header->section_count) * sizeof(SectionEntry);
+
+    bool valid = memcmp(header->magic, MESH_CACHE_MAGIC, 4) == 0 &&
+                 header->version == MESH_CACHE_VERSION &&
+                 header->path_hash == path_hash(source_path) &&
+                 header->config == config &&
+                 header->source_size == source_size &&
+                 table_end <= mapping_size;
+
+    //touched but unchanged sources only cost a rehash
+    if (valid && header->source_mtime != source_mtime)
+    {
+        uint64_t source_hash;
+        valid = hash_source(source_path, source_hash) && source_hash == header->source_hash;
+    }
+
+    if (valid)
+    {
+        sections = reinterpret_cast<const SectionEntry *>(static_cast<const char *>(mapping) + sizeof(MeshCacheHeader));
+        section_count = header->section_count;
+
+        for (uint32_t i = 0; i < section_count; i++)
+        {
+            if (sections[i].offset > mapping_size || sections[i].size > mapping_size - sections[i].offset)
+                valid = false;
+        }
+
+        valid = valid && dependencies_match();
+    }
+
+    if (!valid)
+        close();
+
+    return valid;
+}
+
+void MeshCache::close()
+{
+    if (mapping)
+        munmap(mapping, mapping_size);
+
+    mapping = nullptr;
+    mapping_size = 0;
+    sections = nullptr;
+    section_count = 0;
+}
+
+const MeshCache::SectionEntry *MeshCache::find(MeshCacheSection section) const
+{
+    for (uint32_t i = 0; i < section_count; i++)
+    {
+        if (sections[i].id == static_cast<uint32_t>(section))
+            return &sections[i];
+    }
+    return nullptr;
+}
+
+//same rules as the source: size has to match, a changed mtime falls back to the hash
+bool MeshCache::dependencies_match() const
+{
+    const SectionEntry *entry = find(MeshCacheSection::dependencies);
+    if (!entry)
+        return false;
+
+    const char *p = static_cast<const char *>(mapping) + entry->offset;
+    const char *end = p + entry->size;
+
+    while (p < end)
+    {
+        DependencyEntry dependency;
+        if (static_cast<size_t>(end - p) < sizeof(DependencyEntry))
+            return false;
+        memcpy(&dependency, p, sizeof(DependencyEntry));
+        p += sizeof(DependencyEntry);
+
+        if (dependency.path_size > static_cast<size_t>(end - p))
+            return false;
+        std::string path(p, dependency.path_size);
+        p += align_up(dependency.path_size, 8);
+
+        uint64_t size;
+        int64_t mtime;
+        bool exists = stat_source(path, size, mtime);
+
+        if (dependency.missing)
+        {
+            if (exists)
+                return false;
+            continue;
+        }
+
+        if (!exists || size != dependency.size)
+            return false;
+
+        uint64_t hash;
+        if (mtime != dependency.mtime && (!hash_source(path, hash) || hash != dependency.hash))
+            return false;
+    }
+
+    return true;
+}
+
+bool MeshCache::has(MeshCacheSection section) const
+{
+    return find(section) != nullptr;
+}
+
+const void *MeshCache::data(MeshCacheSection section) const
+{
+    const SectionEntry *entry = find(section);
+    return entry ? static_cast<const char *>(mapping) + entry->offset : nullptr;
+}
+
+size_t MeshCache::size(MeshCacheSection section) const
+{
+    const SectionEntry *entry = find(section);
+    return entry ? static_cast<size_t>(entry->size) : 0;
+}
+
+bool MeshCache::stamp(const std::string &source_path, const std::vector<std::string> &dependencies, MeshCacheStamp &stamp)
+{
+    if (!stat_source(source_path, stamp.source_size, stamp.source_mtime) ||
+        !hash_source(source_path, stamp.source_hash))
+        return false;
+
+    stamp.dependencies.clear();
+    for (const auto &path : dependencies)
+    {
+        DependencyEntry dependency{};
+        dependency.path_size = static_cast<uint32_t>(path.size());
+        dependency.missing = !stat_source(path, dependency.size, dependency.mtime);
+
+        if (!dependency.missing && !hash_source(path, dependency.hash))
+            return false;
+
+        stamp.dependencies.append(reinterpret_cast<const char *>(&dependency), sizeof(dependency));
+        stamp.dependencies.append(path);
+        stamp.dependencies.append(align_up(path.size(), 8) - path.size(), '\0');
+    }
+
+    return true;
+}
+
+bool MeshCache::store(const std::string &source_path, uint64_t config, const MeshCacheStamp &stamp,
+                      const std::vector<MeshCacheBlob> &source_blobs)
+{
+    std::vector<MeshCacheBlob> blobs = source_blobs;
+    blobs.push_back({MeshCacheSection::dependencies, stamp.dependencies.data(), stamp.dependencies.size()});
+
+    MeshCacheHeader header{};
+    memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+    header.version = MESH_CACHE_VERSION;
+    header.source_size = stamp.source_size;
+    header.source_mtime = stamp.source_mtime;
+    header.source_hash = stamp.source_hash;
+    header.path_hash = path_hash(source_path);
+    header.config = config;
+    header.section_count = static_cast<uint32_t>(blobs.size());
+
+    std::vector<SectionEntry> entries;
+    uint64_t offset = align_up(sizeof(MeshCacheHeader) + blobs.size() * sizeof(SectionEntry), MESH_CACHE_ALIGNMENT);
+
+    for (const auto &blob : blobs)
+    {
+        entries.push_back({static_cast<uint32_t>(blob.section), 0, offset, blob.size});
+        offset = align_up(offset + blob.size, MESH_CACHE_ALIGNMENT);
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(MESH_CACHE_DIR, ec);
+
+    //write then rename so a concurrent launch never maps a half written blob
+    std::string path = cache_path(source_path);
+    std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(SectionEntry));
+
+    const char padding[MESH_CACHE_ALIGNMENT] = {};
+    uint64_t position = sizeof(header) + entries.size() * sizeof(SectionEntry);
+
+    for (size_t i = 0; i < blobs.size(); i++)
+    {
+        file.write(padding, entries[i].offset - position);
+        file.write(static_cast<const char *>(blobs[i].data), blobs[i].size);
+        position = entries[i].offset + blobs[i].size;
+    }
+
+    file.close();
+
+    if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
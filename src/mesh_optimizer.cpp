@@ -0,0 +1,680 @@
+#include "mesh_optimizer.h"
+
+#include <cmath>
+#include <vector>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+const int FORSYTH_CACHE_SIZE = 32;
+const int FORSYTH_MAX_VALENCE = 64;
+
+struct ForsythScores
+{
+    float cache[FORSYTH_CACHE_SIZE];
+    float valence[FORSYTH_MAX_VALENCE];
+
+    ForsythScores()
+    {
+        //the last triangle's vertices get a fixed score so its neighbours don't always win
+        for (int i = 0; i < FORSYTH_CACHE_SIZE; i++)
+            cache[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) / float(FORSYTH_CACHE_SIZE - 3), 1.5f);
+
+        //boost vertices with few triangles left so they get finished and leave the cache
+        valence[0] = 0.0f;
+        for (int i = 1; i < FORSYTH_MAX_VALENCE; i++)
+            valence[i] = 2.0f * powf(float(i), -0.5f);
+    }
+
+    float vertex(int cache_position, uint32_t live_triangles) const
+    {
+        if (live_triangles == 0)
+            return -1.0f;
+
+        float score = cache_position >= 0 ? cache[cache_position] : 0.0f;
+        return score + (live_triangles < FORSYTH_MAX_VALENCE ? valence[live_triangles] : 2.0f * powf(float(live_triangles), -0.5f));
+    }
+};
+
+VertexCacheStatistics analyze_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count, uint32_t cache_size)
+{
+    VertexCacheStatistics statistics{};
+    if (index_count < 3 || vertex_count == 0)
+        return statistics;
+
+    //timestamps instead of a real queue, a vertex hits if it entered within the last cache_size misses
+    std::vector<size_t> entered(vertex_count, 0);
+    std::vector<bool> referenced(vertex_count, false);
+
+    size_t misses = 0;
+    size_t referenced_count = 0;
+
+    for (size_t i = 0; i < index_count; i++)
+    {
+        uint32_t v = indices[i];
+
+        if (!referenced[v])
+        {
+            referenced[v] = true;
+            referenced_count++;
+        }
+
+        if (entered[v] == 0 || misses + 1 - entered[v] > cache_size)
+        {
+            misses++;
+            entered[v] = misses;
+        }
+    }
+
+    statistics.acmr = float(misses) / float(index_count / 3);
+    statistics.atvr = float(misses) / float(referenced_count);
+    return statistics;
+}
+
+//indices have to be numbered 0 to vertex_count - 1, all the scratch below is per vertex
+static void forsyth_reorder(uint32_t *indices, size_t index_count, size_t vertex_count)
+{
+    static const ForsythScores scores;
+
+    size_t triangle_count = index_count / 3;
+    if (triangle_count == 0)
+        return;
+
+    //per vertex lists of triangles not yet emitted, live_triangles[v] entries long
+    std::vector<uint32_t> live_triangles(vertex_count, 0);
+    for (size_t i = 0; i < triangle_count * 3; i++)
+        live_triangles[indices[i]]++;
+
+    std::vector<uint32_t> offsets(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; v++)
+        offsets[v + 1] = offsets[v] + live_triangles[v];
+
+    std::vector<uint32_t> adjacency(triangle_count * 3);
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangle_count * 3; i++)
+        adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+    std::vector<float> vertex_scores(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++)
+        vertex_scores[v] = scores.vertex(-1, live_triangles[v]);
+
+    std::vector<bool> emitted(triangle_count, false);
+
+    int64_t best = 0;
+    float best_score = -1.0f;
+    for (size_t t = 0; t < triangle_count; t++)
+    {
+        const uint32_t *tri = indices + 3 * t;
+        float score = vertex_scores[tri[0]] + vertex_scores[tri[1]] + vertex_scores[tri[2]];
+        if (score > best_score)
+        {
+            best_score = score;
+            best = static_cast<int64_t>(t);
+        }
+    }
+
+    std::vector<uint32_t> output(triangle_count * 3);
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t new_cache[FORSYTH_CACHE_SIZE + 3];
+    int cache_count = 0;
+    size_t input_cursor = 0;
+
+    for (size_t out = 0; out < triangle_count; out++)
+    {
+        //nothing in the cache has triangles left, restart from the next unemitted one in input order
+        if (best < 0)
+        {
+            while (emitted[input_cursor])
+                input_cursor++;
+            best = static_cast<int64_t>(input_cursor);
+        }
+
+        const uint32_t *tri = indices + 3 * best;
+        memcpy(&output[3 * out], tri, 3 * sizeof(uint32_t));
+        emitted[best] = true;
+
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = tri[k];
+            uint32_t *list = &adjacency[offsets[v]];
+            uint32_t count = live_triangles[v];
+
+            for (uint32_t j = 0; j < count; j++)
+            {
+                if (list[j] == best)
+                {
+                    list[j] = list[count - 1];
+                    live_triangles[v]--;
+                    break;
+                }
+            }
+        }
+
+        int new_count = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if (k > 0 && tri[k] == tri[0])
+                continue;
+            if (k > 1 && tri[k] == tri[1])
+                continue;
+            new_cache[new_count++] = tri[k];
+        }
+
+        for (int i = 0; i < cache_count; i++)
+        {
+            uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                new_cache[new_count++] = v;
+        }
+
+        for (int i = FORSYTH_CACHE_SIZE; i < new_count; i++)
+        {
+            uint32_t v = new_cache[i];
+            vertex_scores[v] = scores.vertex(-1, live_triangles[v]);
+        }
+
+        cache_count = new_count < FORSYTH_CACHE_SIZE ? new_count : FORSYTH_CACHE_SIZE;
+        memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+
+        for (int i = 0; i < cache_count; i++)
+        {
+            uint32_t v = cache[i];
+            vertex_scores[v] = scores.vertex(i, live_triangles[v]);
+        }
+
+        //only triangles touching the cache changed score enough to matter
+        best = -1;
+        best_score = -1.0f;
+
+        for (int i = 0; i < cache_count; i++)
+        {
+            uint32_t v = cache[i];
+            const uint32_t *list = &adjacency[offsets[v]];
+
+            for (uint32_t j = 0; j < live_triangles[v]; j++)
+            {
+                uint32_t t = list[j];
+                const uint32_t *other = indices + 3 * t;
+                float score = vertex_scores[other[0]] + vertex_scores[other[1]] + vertex_scores[other[2]];
+
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best = t;
+                }
+            }
+        }
+    }
+
+    memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+void optimize_vertex_cache(uint32_t *indices, size_t index_count)
+{
+    //number the range's own vertices so the scratch is sized by them and not by the whole vertex buffer
+    std::vector<uint32_t> vertex_ids(indices, indices + index_count);
+    std::sort(vertex_ids.begin(), vertex_ids.end());
+    vertex_ids.erase(std::unique(vertex_ids.begin(), vertex_ids.end()), vertex_ids.end());
+
+    for (size_t i = 0; i < index_count; i++)
+        indices[i] = static_cast<uint32_t>(std::lower_bound(vertex_ids.begin(), vertex_ids.end(), indices[i]) - vertex_ids.begin());
+
+    forsyth_reorder(indices, index_count, vertex_ids.size());
+
+    for (size_t i = 0; i < index_count; i++)
+        indices[i] = vertex_ids[indices[i]];
+}
+
+size_t optimize_vertex_fetch(void *vertices, size_t vertex_count, size_t vertex_size, uint32_t *indices, size_t index_count)
+{
+    std::vector<uint32_t> remap(vertex_count, UINT32_MAX);
+    uint32_t next = 0;
+
+    for (size_t i = 0; i < index_count; i++)
+    {
+        uint32_t &index = indices[i];
+        if (remap[index] == UINT32_MAX)
+            remap[index] = next++;
+        index = remap[index];
+    }
+
+    char *data = static_cast<char *>(vertices);
+    std::vector<char> original(data, data + vertex_count * vertex_size);
+
+    for (size_t v = 0; v < vertex_count; v++)
+    {
+        if (remap[v] != UINT32_MAX)
+            memcpy(data + remap[v] * vertex_size, &original[v * vertex_size], vertex_size);
+    }
+
+    return next;
+}
+
+std::vector<Submesh> split_submeshes(const uint32_t *indices, const std::vector<Submesh> &ranges, size_t vertex_count,
+                                     std::vector<uint16_t> &local_indices, std::vector<uint32_t> &vertex_remap,
+                                     uint32_t max_vertices)
+{
+    std::vector<Submesh> submeshes;
+    vertex_remap.clear();
+
+    size_t index_count = 0;
+    for (const auto &range : ranges)
+        index_count = std::max<size_t>(index_count, range.first_index + range.index_count);
+    local_indices.resize(index_count);
+
+    //submesh a vertex was last added to, and its index there
+    std::vector<uint32_t> owner(vertex_count, UINT32_MAX);
+    std::vector<uint32_t> local(vertex_count);
+
+    for (const auto &range : ranges)
+    {
+        uint32_t submesh_id = static_cast<uint32_t>(submeshes.size());
+        uint32_t submesh_vertices = 0;
+        Submesh current{range.first_index, 0, static_cast<int32_t>(vertex_remap.size()), range.material};
+
+        for (uint32_t t = range.first_index; t + 3 <= range.first_index + range.index_count; t += 3)
+        {
+            const uint32_t *tri = indices + t;
+
+            uint32_t added = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                if (owner[tri[k]] != submesh_id && (k < 1 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1]))
+                    added++;
+            }
+
+            if (submesh_vertices + added > max_vertices)
+            {
+                submeshes.push_back(current);
+                submesh_id++;
+                submesh_vertices = 0;
+                current = {t, 0, static_cast<int32_t>(vertex_remap.size()), range.material};
+            }
+
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = tri[k];
+                if (owner[v] != submesh_id)
+                {
+                    owner[v] = submesh_id;
+                    local[v] = submesh_vertices++;
+                    vertex_remap.push_back(v);
+                }
+                local_indices[t + k] = static_cast<uint16_t>(local[v]);
+            }
+
+            current.index_count += 3;
+        }
+
+        if (current.index_count > 0)
+            submeshes.push_back(current);
+    }
+
+    return submeshes;
+}
+
+static const float *position_at(const float *positions, size_t position_stride, uint32_t v)
+{
+    return reinterpret_cast<const float *>(reinterpret_cast<const char *>(positions) + v * position_stride);
+}
+
+static void compute_meshlet_bounds(Meshlet &meshlet, const uint32_t *indices, const float *positions, size_t position_stride)
+{
+    float lo[3] = {INFINITY, INFINITY, INFINITY};
+    float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    float axis[3] = {0.0f, 0.0f, 0.0f};
+
+    std::vector<float> normals;
+    normals.reserve(meshlet.index_count);
+
+    for (uint32_t t = meshlet.first_index; t < meshlet.first_index + meshlet.index_count; t += 3)
+    {
+        const float *p[3];
+        for (int k = 0; k < 3; k++)
+        {
+            p[k] = position_at(positions, position_stride, indices[t + k]);
+            for (int i = 0; i < 3; i++)
+            {
+                lo[i] = std::min(lo[i], p[k][i]);
+                hi[i] = std::max(hi[i], p[k][i]);
+            }
+        }
+
+        float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+        float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+        float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0f)
+            continue;
+
+        for (int i = 0; i < 3; i++)
+        {
+            normals.push_back(n[i] / length);
+            axis[i] += n[i] / length;
+        }
+    }
+
+    for (int i = 0; i < 3; i++)
+        meshlet.center[i] = 0.5f * (lo[i] + hi[i]);
+
+    meshlet.radius = 0.0f;
+    for (uint32_t t = meshlet.first_index; t < meshlet.first_index + meshlet.index_count; t++)
+    {
+        const float *p = position_at(positions, position_stride, indices[t]);
+        float d[3] = {p[0] - meshlet.center[0], p[1] - meshlet.center[1], p[2] - meshlet.center[2]};
+        meshlet.radius = std::max(meshlet.radius, sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+    }
+
+    //the cone must contain every triangle normal, if it opens to a half space or more it culls nothing
+    float axis_length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float min_dot = 1.0f;
+
+    for (int i = 0; i < 3; i++)
+        meshlet.cone_axis[i] = axis_length > 0.0f ? axis[i] / axis_length : 0.0f;
+
+    for (size_t i = 0; i < normals.size(); i += 3)
+        min_dot = std::min(min_dot, normals[i] * meshlet.cone_axis[0] + normals[i + 1] * meshlet.cone_axis[1] + normals[i + 2] * meshlet.cone_axis[2]);
+
+    meshlet.cone_cutoff = axis_length > 0.0f && min_dot > 0.0f ? sqrtf(1.0f - min_dot * min_dot) : 1.0f;
+}
+
+std::vector<Meshlet> build_meshlets(const uint32_t *indices, const std::vector<Submesh> &submeshes,
+                                    const float *positions, size_t position_stride, size_t vertex_count,
+                                    uint32_t max_vertices, uint32_t max_triangles)
+{
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> owner(vertex_count, UINT32_MAX);
+
+    for (const auto &submesh : submeshes)
+    {
+        Meshlet current{};
+        current.first_index = submesh.first_index;
+        current.vertex_offset = submesh.vertex_offset;
+        uint32_t current_vertices = 0;
+
+        for (uint32_t t = submesh.first_index; t < submesh.first_index + submesh.index_count; t += 3)
+        {
+            const uint32_t *tri = indices + t;
+            uint32_t id = static_cast<uint32_t>(meshlets.size());
+
+            uint32_t added = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                if (owner[tri[k]] != id && (k < 1 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1]))
+                    added++;
+            }
+
+            if (current_vertices + added > max_vertices || current.index_count / 3 == max_triangles)
+            {
+                compute_meshlet_bounds(current, indices, positions, position_stride);
+                meshlets.push_back(current);
+
+                current.first_index = t;
+                current.index_count = 0;
+                current_vertices = 0;
+                id++;
+            }
+
+            for (int k = 0; k < 3; k++)
+            {
+                if (owner[tri[k]] != id)
+                {
+                    owner[tri[k]] = id;
+                    current_vertices++;
+                }
+            }
+
+            current.index_count += 3;
+        }
+
+        if (current.index_count > 0)
+        {
+            compute_meshlet_bounds(current, indices, positions, position_stride);
+            meshlets.push_back(current);
+        }
+    }
+
+    return meshlets;
+}
+
+//sum of area weighted squared plane distances, divided by the weight when evaluated
+struct Quadric
+{
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+
+    void add(const Quadric &other)
+    {
+        a00 += other.a00, a01 += other.a01, a02 += other.a02;
+        a11 += other.a11, a12 += other.a12, a22 += other.a22;
+        b0 += other.b0, b1 += other.b1, b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+    }
+
+    float error(const float *p) const
+    {
+        double x = p[0], y = p[1], z = p[2];
+        double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                   2.0 * (b0 * x + b1 * y + b2 * z) + c;
+
+        return weight > 0.0 ? static_cast<float>(std::max(e, 0.0) / weight) : 0.0f;
+    }
+};
+
+static void triangle_normal(const float *p0, const float *p1, const float *p2, double n[3])
+{
+    double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+size_t simplify_mesh(uint32_t *destination, const uint32_t *indices, size_t index_count,
+                     const float *source_positions, size_t source_stride,
+                     size_t target_index_count, float *result_error)
+{
+    //compact the vertices the range references once, so the per vertex state of every pass is sized by them
+    std::vector<uint32_t> vertex_ids(indices, indices + index_count / 3 * 3);
+    std::sort(vertex_ids.begin(), vertex_ids.end());
+    vertex_ids.erase(std::unique(vertex_ids.begin(), vertex_ids.end()), vertex_ids.end());
+
+    size_t vertex_count = vertex_ids.size();
+    std::vector<float> local_positions(3 * vertex_count);
+    for (size_t v = 0; v < vertex_count; v++)
+        memcpy(&local_positions[3 * v], position_at(source_positions, source_stride, vertex_ids[v]), 3 * sizeof(float));
+
+    const float *positions = local_positions.data();
+    const size_t position_stride = 3 * sizeof(float);
+
+    std::vector<uint32_t> result(index_count / 3 * 3);
+    for (size_t i = 0; i < result.size(); i++)
+        result[i] = static_cast<uint32_t>(std::lower_bound(vertex_ids.begin(), vertex_ids.end(), indices[i]) - vertex_ids.begin());
+
+    std::vector<Quadric> quadrics(vertex_count, Quadric{});
+    for (size_t t = 0; t < result.size(); t += 3)
+    {
+        const float *p0 = position_at(positions, position_stride, result[t + 0]);
+        const float *p1 = position_at(positions, position_stride, result[t + 1]);
+        const float *p2 = position_at(positions, position_stride, result[t + 2]);
+
+        double n[3];
+        triangle_normal(p0, p1, p2, n);
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0)
+            continue;
+
+        n[0] /= length, n[1] /= length, n[2] /= length;
+        double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+        double w = 0.5 * length;
+
+        Quadric q = {w * n[0] * n[0], w * n[0] * n[1], w * n[0] * n[2], w * n[1] * n[1], w * n[1] * n[2], w * n[2] * n[2],
+                     w * n[0] * d, w * n[1] * d, w * n[2] * d, w * d * d, w};
+
+        for (int k = 0; k < 3; k++)
+            quadrics[result[t + k]].add(q);
+    }
+
+    //a directed edge without its twin is a border or seam, one that appears twice is non-manifold
+    std::vector<uint64_t> edges;
+    edges.reserve(result.size());
+    for (size_t t = 0; t < result.size(); t += 3)
+    {
+        for (int k = 0; k < 3; k++)
+            edges.push_back(uint64_t(result[t + k]) << 32 | result[t + (k + 1) % 3]);
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> locked(vertex_count, false);
+    for (size_t i = 0; i < edges.size(); i++)
+    {
+        uint64_t twin = edges[i] << 32 | edges[i] >> 32;
+        bool duplicate = (i > 0 && edges[i - 1] == edges[i]) || (i + 1 < edges.size() && edges[i + 1] == edges[i]);
+
+        if (duplicate || !std::binary_search(edges.begin(), edges.end(), twin))
+        {
+            locked[edges[i] >> 32] = true;
+            locked[edges[i] & 0xffffffff] = true;
+        }
+    }
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        float error;
+    };
+
+    std::vector<uint32_t> remap(vertex_count);
+    std::vector<uint8_t> touched(vertex_count);
+    std::vector<uint32_t> offsets(vertex_count + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    float max_error = 0.0f;
+
+    //passes of independent collapses, cheapest first, until the target or nothing is left to collapse
+    while (result.size() > target_index_count)
+    {
+        size_t triangle_count = result.size() / 3;
+
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (uint32_t v : result)
+            offsets[v + 1]++;
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        adjacency.resize(result.size());
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < result.size(); i++)
+            adjacency[cursor[result[i]]++] = static_cast<uint32_t>(i / 3);
+
+        collapses.clear();
+        for (size_t t = 0; t < triangle_count; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t a = result[3 * t + k];
+                uint32_t b = result[3 * t + (k + 1) % 3];
+
+                for (int direction = 0; direction < 2; direction++, std::swap(a, b))
+                {
+                    if (locked[a])
+                        continue;
+
+                    Quadric q = quadrics[a];
+                    q.add(quadrics[b]);
+                    collapses.push_back({a, b, q.error(position_at(positions, position_stride, b))});
+                }
+            }
+        }
+
+        if (collapses.empty())
+            break;
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &l, const Collapse &r) { return l.error < r.error; });
+
+        //each collapse removes about two triangles
+        size_t collapse_goal = std::max<size_t>(1, (result.size() - target_index_count) / 6);
+        size_t collapsed = 0;
+
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(touched.begin(), touched.end(), 0);
+
+        for (const auto &collapse : collapses)
+        {
+            if (collapsed >= collapse_goal)
+                break;
+
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            const float *target = position_at(positions, position_stride, collapse.to);
+            bool flips = false;
+
+            for (uint32_t j = offsets[collapse.from]; j < offsets[collapse.from + 1] && !flips; j++)
+            {
+                const uint32_t *tri = &result[3 * adjacency[j]];
+                if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+                    continue;
+
+                const float *before[3];
+                const float *after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = position_at(positions, position_stride, tri[k]);
+                    after[k] = tri[k] == collapse.from ? target : before[k];
+                }
+
+                double n0[3], n1[3];
+                triangle_normal(before[0], before[1], before[2], n0);
+                triangle_normal(after[0], after[1], after[2], n1);
+                flips = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0;
+            }
+
+            if (flips)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            max_error = std::max(max_error, collapse.error);
+            collapsed++;
+
+            //the whole one ring is frozen so later flip checks in this pass see final positions
+            touched[collapse.to] = 1;
+            for (uint32_t j = offsets[collapse.from]; j < offsets[collapse.from + 1]; j++)
+            {
+                const uint32_t *tri = &result[3 * adjacency[j]];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+        }
+
+        if (collapsed == 0)
+            break;
+
+        size_t write = 0;
+        for (size_t t = 0; t < triangle_count; t++)
+        {
+            uint32_t a = remap[result[3 * t + 0]];
+            uint32_t b = remap[result[3 * t + 1]];
+            uint32_t c = remap[result[3 * t + 2]];
+
+            if (a == b || b == c || a == c)
+                continue;
+
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+    }
+
+    for (size_t i = 0; i < result.size(); i++)
+        destination[i] = vertex_ids[result[i]];
+    if (result_error)
+        *result_error = sqrtf(max_error);
+
+    return result.size();
+}
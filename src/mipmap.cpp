@@ -0,0 +1,83 @@
+#include "mipmap.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+uint32_t mip_level_count(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+        levels++;
+    return levels;
+}
+
+void downsample_rgba8(const uint8_t *source, uint32_t width, uint32_t height, uint8_t *destination)
+{
+    uint32_t dst_width = std::max(width / 2, 1u);
+    uint32_t dst_height = std::max(height / 2, 1u);
+
+    for (uint32_t y = 0; y < dst_height; y++)
+    {
+        const uint8_t *row0 = source + size_t(std::min(2 * y, height - 1)) * width * 4;
+        const uint8_t *row1 = source + size_t(std::min(2 * y + 1, height - 1)) * width * 4;
+        uint8_t *out = destination + size_t(y) * dst_width * 4;
+        uint32_t x = 0;
+
+#ifdef __SSE2__
+        //4 source pixels of both rows -> 2 destination pixels, channels summed in 16 bits
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(2);
+
+        for (; x + 2 <= dst_width && 2 * x + 4 <= width; x += 2)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 8 * x));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 8 * x));
+
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); //pixels 0, 1
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); //pixels 2, 3
+
+            __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 4 * x), _mm_packus_epi16(sum, sum));
+        }
+#endif
+
+        for (; x < dst_width; x++)
+        {
+            uint32_t x0 = std::min(2 * x, width - 1) * 4;
+            uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+
+            for (int c = 0; c < 4; c++)
+                out[4 * x + c] = static_cast<uint8_t>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+        }
+    }
+}
+
+void build_mip_chain(std::vector<uint8_t> &image, uint32_t width, uint32_t height)
+{
+    size_t total = size_t(width) * height * 4;
+    for (uint32_t w = width, h = height; w > 1 || h > 1;)
+    {
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+        total += size_t(w) * h * 4;
+    }
+    image.resize(total);
+
+    const uint8_t *source = image.data();
+    uint8_t *destination = image.data() + size_t(width) * height * 4;
+
+    while (width > 1 || height > 1)
+    {
+        downsample_rgba8(source, width, height, destination);
+
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+        source = destination;
+        destination += size_t(width) * height * 4;
+    }
+}
@@ -0,0 +1,562 @@
+#include "obj_parser.h"
+
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+enum class ObjEventType
+{
+    shape,
+    material,
+    material_library,
+    smoothing
+};
+
+//state changes are replayed in file order during the merge, face is the chunk triangle count at that point
+struct ObjEvent
+{
+    size_t face;
+    ObjEventType type;
+    std::string name;
+    unsigned int smoothing_id;
+};
+
+//negative obj indices are resolved against chunk-local counts and flagged for rebasing in the merge
+const uint8_t RELATIVE_VERTEX = 1 << 0;
+const uint8_t RELATIVE_NORMAL = 1 << 1;
+const uint8_t RELATIVE_TEXCOORD = 1 << 2;
+
+struct ObjChunk
+{
+    std::vector<tinyobj::real_t> vertices;
+    std::vector<tinyobj::real_t> normals;
+    std::vector<tinyobj::real_t> texcoords;
+
+    std::vector<tinyobj::index_t> indices; //three per triangle
+    std::vector<uint8_t> relative;         //RELATIVE_* flags, one per index
+    std::vector<size_t> quads;             //first triangle of each split quad, diagonal picked after the merge
+    std::vector<ObjEvent> events;
+
+    size_t line_count = 0;
+    size_t error_line = 0;
+    std::string error;
+};
+
+static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+static inline bool starts_with(const char *p, const char *end, const char *keyword, size_t length)
+{
+    return static_cast<size_t>(end - p) > length && memcmp(p, keyword, length) == 0 && is_space(p[length]);
+}
+
+//rest of the line with surrounding whitespace removed
+static std::string parse_name(const char *p, const char *end)
+{
+    p = skip_space(p, end);
+    while (end > p && is_space(end[-1]))
+        end--;
+    return std::string(p, end);
+}
+
+//up to 18 significant digits, exact powers of ten in double so values round like strtod for typical obj data
+static bool parse_real(const char *&p, const char *end, tinyobj::real_t &value)
+{
+    p = skip_space(p, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool has_digits = false;
+
+    for (; p < end && is_digit(*p); p++, has_digits = true)
+    {
+        if (mantissa < 100000000000000000ULL)
+            mantissa = mantissa * 10 + (*p - '0');
+        else
+            exponent++;
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && is_digit(*p); p++, has_digits = true)
+        {
+            if (mantissa < 100000000000000000ULL)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+
+    if (!has_digits)
+        return false;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative_exponent = *p++ == '-';
+
+        int e = 0;
+        for (; p < end && is_digit(*p); p++)
+            e = std::min(e * 10 + (*p - '0'), 9999);
+
+        exponent += negative_exponent ? -e : e;
+    }
+
+    double result = static_cast<double>(mantissa);
+    if (exponent < 0)
+        result = exponent >= -22 ? result / POW10[-exponent] : result * std::pow(10.0, exponent);
+    else if (exponent > 0)
+        result = exponent <= 22 ? result * POW10[exponent] : result * std::pow(10.0, exponent);
+
+    value = static_cast<tinyobj::real_t>(negative ? -result : result);
+    return true;
+}
+
+static bool parse_int(const char *&p, const char *end, int &value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    if (p == end || !is_digit(*p))
+        return false;
+
+    int result = 0;
+    for (; p < end && is_digit(*p); p++)
+        result = result * 10 + (*p - '0');
+
+    value = negative ? -result : result;
+    return true;
+}
+
+static bool resolve_index(int value, size_t local_count, int &index, uint8_t &relative, uint8_t relative_bit)
+{
+    if (value > 0)
+        index = value - 1;
+    else if (value < 0)
+    {
+        //may point into an earlier chunk, rebasing in the merge makes it non-negative again
+        index = static_cast<int>(local_count) + value;
+        relative |= relative_bit;
+    }
+    else
+        return false;
+
+    return true;
+}
+
+//v, v/vt, v//vn or v/vt/vn
+static bool parse_face_vertex(const char *&p, const char *end, const ObjChunk &chunk,
+                              tinyobj::index_t &index, uint8_t &relative)
+{
+    index = {-1, -1, -1};
+    relative = 0;
+
+    int value;
+    if (!parse_int(p, end, value) ||
+        !resolve_index(value, chunk.vertices.size() / 3, index.vertex_index, relative, RELATIVE_VERTEX))
+        return false;
+
+    if (p == end || *p != '/')
+        return true;
+    p++;
+
+    if (p < end && *p != '/')
+    {
+        if (!parse_int(p, end, value) ||
+            !resolve_index(value, chunk.texcoords.size() / 2, index.texcoord_index, relative, RELATIVE_TEXCOORD))
+            return false;
+    }
+
+    if (p == end || *p != '/')
+        return true;
+    p++;
+
+    return parse_int(p, end, value) &&
+           resolve_index(value, chunk.normals.size() / 3, index.normal_index, relative, RELATIVE_NORMAL);
+}
+
+//the fan gives [0, 1, 2], [0, 2, 3], switch to [0, 1, 3], [1, 2, 3] when 1-3 is the shorter diagonal, like tinyobj
+static void split_quad(tinyobj::index_t *triangles, const std::vector<tinyobj::real_t> &vertices)
+{
+    tinyobj::index_t quad[4] = {triangles[0], triangles[1], triangles[2], triangles[5]};
+
+    for (const auto &index : quad)
+    {
+        if (index.vertex_index < 0 || 3 * static_cast<size_t>(index.vertex_index) + 2 >= vertices.size())
+            return;
+    }
+
+    auto squared_distance = [&](const tinyobj::index_t &a, const tinyobj::index_t &b) {
+        const tinyobj::real_t *pa = &vertices[3 * a.vertex_index];
+        const tinyobj::real_t *pb = &vertices[3 * b.vertex_index];
+        tinyobj::real_t x = pb[0] - pa[0], y = pb[1] - pa[1], z = pb[2] - pa[2];
+        return x * x + y * y + z * z;
+    };
+
+    if (squared_distance(quad[0], quad[2]) < squared_distance(quad[1], quad[3]))
+        return;
+
+    tinyobj::index_t split[6] = {quad[0], quad[1], quad[3], quad[1], quad[2], quad[3]};
+    std::copy(split, split + 6, triangles);
+}
+
+static void parse_chunk(const char *begin, const char *end, ObjChunk &chunk)
+{
+    std::vector<tinyobj::index_t> polygon;
+    std::vector<uint8_t> polygon_relative;
+
+    for (const char *line = begin; line < end; chunk.line_count++)
+    {
+        const char *line_end = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (!line_end)
+            line_end = end;
+
+        const char *p = skip_space(line, line_end);
+        line = line_end < end ? line_end + 1 : end;
+
+        if (line_end - p < 2)
+            continue;
+
+        bool ok = true;
+
+        if (p[0] == 'v' && is_space(p[1]))
+        {
+            p += 2;
+            tinyobj::real_t x, y, z;
+            ok = parse_real(p, line_end, x) && parse_real(p, line_end, y) && parse_real(p, line_end, z);
+            chunk.vertices.insert(chunk.vertices.end(), {x, y, z});
+        }
+        else if (p[0] == 'v' && p[1] == 'n' && starts_with(p, line_end, "vn", 2))
+        {
+            p += 3;
+            tinyobj::real_t x, y, z;
+            ok = parse_real(p, line_end, x) && parse_real(p, line_end, y) && parse_real(p, line_end, z);
+            chunk.normals.insert(chunk.normals.end(), {x, y, z});
+        }
+        else if (p[0] == 'v' && p[1] == 't' && starts_with(p, line_end, "vt", 2))
+        {
+            p += 3;
+            tinyobj::real_t u, v = 0.0f;
+            ok = parse_real(p, line_end, u);
+            parse_real(p, line_end, v);
+            chunk.texcoords.insert(chunk.texcoords.end(), {u, v});
+        }
+        else if (p[0] == 'f' && is_space(p[1]))
+        {
+            p += 2;
+            polygon.clear();
+            polygon_relative.clear();
+
+            for (p = skip_space(p, line_end); ok && p < line_end; p = skip_space(p, line_end))
+            {
+                tinyobj::index_t index;
+                uint8_t relative;
+                ok = parse_face_vertex(p, line_end, chunk, index, relative);
+                polygon.push_back(index);
+                polygon_relative.push_back(relative);
+            }
+
+            if (ok && polygon.size() == 4)
+                chunk.quads.push_back(chunk.indices.size() / 3);
+
+            //fan triangulation
+            for (size_t i = 2; ok && i < polygon.size(); i++)
+            {
+                chunk.indices.insert(chunk.indices.end(), {polygon[0], polygon[i - 1], polygon[i]});
+                chunk.relative.insert(chunk.relative.end(), {polygon_relative[0], polygon_relative[i - 1], polygon_relative[i]});
+            }
+        }
+        else if ((p[0] == 'o' || p[0] == 'g') && is_space(p[1]))
+        {
+            chunk.events.push_back({chunk.indices.size() / 3, ObjEventType::shape, parse_name(p + 2, line_end), 0});
+        }
+        else if (p[0] == 's' && is_space(p[1]))
+        {
+            p = skip_space(p + 2, line_end);
+
+            //"s off" and anything unparsable mean no smoothing, like tinyobj
+            int id = 0;
+            if (line_end - p >= 3 && memcmp(p, "off", 3) == 0)
+                id = 0;
+            else if (!parse_int(p, line_end, id))
+                id = 0;
+
+            chunk.events.push_back({chunk.indices.size() / 3, ObjEventType::smoothing, "", static_cast<unsigned int>(std::max(id, 0))});
+        }
+        else if (starts_with(p, line_end, "usemtl", 6))
+        {
+            std::string name = parse_name(p + 6, line_end);
+            name = name.substr(0, name.find_first_of(" \t"));
+            chunk.events.push_back({chunk.indices.size() / 3, ObjEventType::material, name, 0});
+        }
+        else if (starts_with(p, line_end, "mtllib", 6))
+        {
+            chunk.events.push_back({chunk.indices.size() / 3, ObjEventType::material_library, parse_name(p + 6, line_end), 0});
+        }
+
+        if (!ok)
+        {
+            chunk.error = "failed to parse line (malformed number or zero face index)";
+            chunk.error_line = chunk.line_count;
+            return;
+        }
+    }
+}
+
+bool load_obj_parallel(tinyobj::attrib_t *attrib, std::vector<tinyobj::shape_t> *shapes,
+                       std::vector<tinyobj::material_t> *materials, std::string *warn, std::string *err,
+                       const char *filename, ThreadPool &pool, const char *mtl_basedir)
+{
+    attrib->vertices.clear();
+    attrib->normals.clear();
+    attrib->texcoords.clear();
+    attrib->colors.clear();
+    shapes->clear();
+
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+    {
+        if (err)
+            *err = "Cannot open file [" + std::string(filename) + "]\n";
+        return false;
+    }
+
+    size_t file_size = (size_t)file.tellg();
+    std::vector<char> buffer(file_size);
+
+    file.seekg(0);
+    file.read(buffer.data(), file_size);
+    file.close();
+
+    //a few chunks per worker so uneven chunks still balance, but never so small that merging dominates
+    const size_t min_chunk_size = 256 * 1024;
+    size_t chunk_count = std::clamp<size_t>(file_size / min_chunk_size, 1, pool.size() * 4);
+    size_t chunk_size = file_size / chunk_count;
+
+    std::vector<std::pair<const char *, const char *>> ranges;
+    const char *data = buffer.data();
+    const char *end = data + file_size;
+
+    for (const char *begin = data; begin < end;)
+    {
+        const char *split = ranges.size() + 1 < chunk_count ? begin + chunk_size : end;
+        if (split < end)
+        {
+            split = static_cast<const char *>(memchr(split, '\n', end - split));
+            split = split ? split + 1 : end;
+        }
+
+        ranges.emplace_back(begin, split);
+        begin = split;
+    }
+
+    std::vector<ObjChunk> chunks(ranges.size());
+    std::vector<std::future<void>> jobs;
+
+    for (size_t i = 0; i < ranges.size(); i++)
+        jobs.push_back(pool.submit([&, i] { parse_chunk(ranges[i].first, ranges[i].second, chunks[i]); }));
+
+    for (auto &job : jobs)
+        pool.wait(job);
+    jobs.clear();
+
+    //prefix sums give every chunk its place in the merged arrays
+    std::vector<size_t> vertex_base(chunks.size() + 1, 0);
+    std::vector<size_t> normal_base(chunks.size() + 1, 0);
+    std::vector<size_t> texcoord_base(chunks.size() + 1, 0);
+    size_t line_base = 0;
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (!chunks[i].error.empty())
+        {
+            if (err)
+            {
+                std::stringstream ss;
+                ss << chunks[i].error << " (line " << line_base + chunks[i].error_line << ")\n";
+                *err += ss.str();
+            }
+            return false;
+        }
+
+        vertex_base[i + 1] = vertex_base[i] + chunks[i].vertices.size();
+        normal_base[i + 1] = normal_base[i] + chunks[i].normals.size();
+        texcoord_base[i + 1] = texcoord_base[i] + chunks[i].texcoords.size();
+        line_base += chunks[i].line_count;
+    }
+
+    attrib->vertices.resize(vertex_base.back());
+    attrib->normals.resize(normal_base.back());
+    attrib->texcoords.resize(texcoord_base.back());
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        jobs.push_back(pool.submit([&, i] {
+            std::copy(chunks[i].vertices.begin(), chunks[i].vertices.end(), attrib->vertices.begin() + vertex_base[i]);
+            std::copy(chunks[i].normals.begin(), chunks[i].normals.end(), attrib->normals.begin() + normal_base[i]);
+            std::copy(chunks[i].texcoords.begin(), chunks[i].texcoords.end(), attrib->texcoords.begin() + texcoord_base[i]);
+        }));
+    }
+
+    for (auto &job : jobs)
+        pool.wait(job);
+    jobs.clear();
+
+    //second pass once every position is in place, quads may reference vertices from any chunk
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        jobs.push_back(pool.submit([&, i] {
+            ObjChunk &chunk = chunks[i];
+
+            for (size_t j = 0; j < chunk.indices.size(); j++)
+            {
+                if (chunk.relative[j] & RELATIVE_VERTEX)
+                    chunk.indices[j].vertex_index += static_cast<int>(vertex_base[i] / 3);
+                if (chunk.relative[j] & RELATIVE_NORMAL)
+                    chunk.indices[j].normal_index += static_cast<int>(normal_base[i] / 3);
+                if (chunk.relative[j] & RELATIVE_TEXCOORD)
+                    chunk.indices[j].texcoord_index += static_cast<int>(texcoord_base[i] / 2);
+            }
+
+            for (size_t quad : chunk.quads)
+                split_quad(&chunk.indices[3 * quad], attrib->vertices);
+        }));
+    }
+
+    for (auto &job : jobs)
+        pool.wait(job);
+
+    //replay object/material/smoothing state in file order
+    std::string base_dir = mtl_basedir ? mtl_basedir : "";
+    if (!base_dir.empty() && base_dir.back() != '/')
+        base_dir += '/';
+
+    tinyobj::MaterialFileReader material_reader(base_dir);
+    std::map<std::string, int> material_map;
+
+    int material = -1;
+    unsigned int smoothing_id = 0;
+    tinyobj::shape_t shape;
+
+    for (const auto &chunk : chunks)
+    {
+        size_t face = 0;
+        auto append_faces = [&](size_t until) {
+            auto &mesh = shape.mesh;
+            mesh.indices.insert(mesh.indices.end(), chunk.indices.begin() + 3 * face, chunk.indices.begin() + 3 * until);
+            mesh.num_face_vertices.insert(mesh.num_face_vertices.end(), until - face, 3);
+            mesh.material_ids.insert(mesh.material_ids.end(), until - face, material);
+            mesh.smoothing_group_ids.insert(mesh.smoothing_group_ids.end(), until - face, smoothing_id);
+            face = until;
+        };
+
+        for (const auto &event : chunk.events)
+        {
+            append_faces(event.face);
+
+            switch (event.type)
+            {
+            case ObjEventType::shape:
+                if (!shape.mesh.indices.empty())
+                    shapes->push_back(std::move(shape));
+                shape = tinyobj::shape_t();
+                shape.name = event.name;
+                break;
+
+            case ObjEventType::material:
+            {
+                auto it = material_map.find(event.name);
+                if (it == material_map.end() && warn)
+                    *warn += "material [ '" + event.name + "' ] not found in .mtl\n";
+                material = it != material_map.end() ? it->second : -1;
+                break;
+            }
+
+            case ObjEventType::material_library:
+            {
+                std::stringstream names(event.name);
+                std::string name;
+                bool found = false;
+
+                while (!found && names >> name)
+                {
+                    std::string mtl_warn, mtl_err;
+                    found = material_reader(name, materials, &material_map, &mtl_warn, &mtl_err);
+                    if (warn)
+                        *warn += mtl_warn;
+                    if (err)
+                        *err += mtl_err;
+                }
+
+                if (!found && warn)
+                    *warn += "Failed to load material file(s). Use default material.\n";
+                break;
+            }
+
+            case ObjEventType::smoothing:
+                smoothing_id = event.smoothing_id;
+                break;
+            }
+        }
+
+        append_faces(chunk.indices.size() / 3);
+    }
+
+    if (!shape.mesh.indices.empty())
+        shapes->push_back(std::move(shape));
+
+    return true;
+}
+
+std::vector<std::string> find_material_libraries(const char *filename, const char *mtl_basedir)
+{
+    std::string base_dir = mtl_basedir ? mtl_basedir : "";
+    if (!base_dir.empty() && base_dir.back() != '/')
+        base_dir += '/';
+
+    std::vector<std::string> paths;
+    std::ifstream file(filename);
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        const char *end = line.data() + line.size();
+        const char *p = skip_space(line.data(), end);
+        if (!starts_with(p, end, "mtllib", 6))
+            continue;
+
+        std::stringstream names(parse_name(p + 6, end));
+        std::string name;
+        while (names >> name)
+            paths.push_back(base_dir + name);
+    }
+
+    return paths;
+}
@@ -0,0 +1,80 @@
+#include "pipeline_cache.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <filesystem>
+
+#include <unistd.h>
+
+static bool header_matches(const std::vector<char> &data, const VkPhysicalDeviceProperties &properties)
+{
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header))
+        return false;
+
+    memcpy(&header, data.data(), sizeof(header));
+
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties.vendorID &&
+           header.deviceID == properties.deviceID &&
+           memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+VkPipelineCache load_pipeline_cache(VkDevice device, const VkPhysicalDeviceProperties &properties, bool &warm)
+{
+    std::vector<char> data;
+    std::ifstream file(PIPELINE_CACHE_PATH, std::ios::binary);
+    if (file.is_open())
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    warm = header_matches(data, properties);
+
+    VkPipelineCacheCreateInfo cache_info{};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.initialDataSize = warm ? data.size() : 0;
+    cache_info.pInitialData = warm ? data.data() : nullptr;
+
+    VkPipelineCache cache;
+    if (vkCreatePipelineCache(device, &cache_info, nullptr, &cache) != VK_SUCCESS)
+        throw std::runtime_error("failed to create pipeline cache!");
+
+    return cache;
+}
+
+bool store_pipeline_cache(VkDevice device, VkPipelineCache cache)
+{
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS)
+        return false;
+
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+        return false;
+    data.resize(size);
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(PIPELINE_CACHE_PATH).parent_path(), ec);
+
+    //write then rename so a crash or a concurrent launch never leaves a truncated cache behind
+    std::string tmp_path = PIPELINE_CACHE_PATH + "." + std::to_string(getpid()) + ".tmp";
+
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    file.write(data.data(), data.size());
+    file.close();
+
+    if (!file || std::rename(tmp_path.c_str(), PIPELINE_CACHE_PATH.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
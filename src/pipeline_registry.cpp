@@ -0,0 +1,367 @@
+#include "pipeline_registry.h"
+
+#include <array>
+#include <iostream>
+#include <stdexcept>
+
+static VkShaderModule create_module(VkDevice device, const std::vector<char> &code)
+{
+    VkShaderModuleCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.codeSize = code.size();
+    create_info.pCode = reinterpret_cast<const uint32_t *>(code.data());
+
+    VkShaderModule shader_module;
+    if (vkCreateShaderModule(device, &create_info, nullptr, &shader_module) != VK_SUCCESS)
+        throw std::runtime_error("failed to create shader module!");
+
+    return shader_module;
+}
+
+void PipelineRegistry::create(VkDevice device, VkPipelineCache cache, ThreadPool &pool,
+                              const std::vector<PipelineVertexInput> &vertex_inputs, const std::vector<char> &fragment_shader)
+{
+    this->device = device;
+    this->cache = cache;
+    this->pool = &pool;
+    this->vertex_inputs = vertex_inputs;
+
+    std::vector<std::vector<char>> vertex_shaders;
+    for (auto &input : this->vertex_inputs)
+        vertex_shaders.push_back(std::move(input.vertex_shader));
+
+    create_modules(vertex_shaders, fragment_shader);
+}
+
+//modules stay around until the next reload, later variants are built from the same ones
+void PipelineRegistry::create_modules(const std::vector<std::vector<char>> &vertex_shaders, const std::vector<char> &fragment_shader)
+{
+    if (vertex_shaders.size() != vertex_inputs.size())
+        throw std::runtime_error("need one vertex shader per vertex input!");
+
+    for (const auto &code : vertex_shaders)
+        vertex_modules.push_back(create_module(device, code));
+    fragment_module = create_module(device, fragment_shader);
+}
+
+void PipelineRegistry::destroy_modules()
+{
+    for (VkShaderModule module : vertex_modules)
+        vkDestroyShaderModule(device, module, nullptr);
+    vkDestroyShaderModule(device, fragment_module, nullptr);
+    vertex_modules.clear();
+    fragment_module = VK_NULL_HANDLE;
+}
+
+void PipelineRegistry::destroy()
+{
+    if (device == VK_NULL_HANDLE)
+        return;
+
+    wait_idle();
+
+    for (auto &variant : variants)
+        vkDestroyPipeline(device, variant.pipeline, nullptr);
+    for (VkPipeline pipeline : retired)
+        vkDestroyPipeline(device, pipeline, nullptr);
+    variants.clear();
+    ids.clear();
+    retired.clear();
+
+    destroy_modules();
+    vertex_inputs.clear();
+
+    device = VK_NULL_HANDLE;
+    render_pass = VK_NULL_HANDLE;
+    layout = VK_NULL_HANDLE;
+}
+
+void PipelineRegistry::set_render_pass(VkRenderPass render_pass, VkPipelineLayout layout, const PipelineKey &fallback)
+{
+    //compiles in flight read render_pass and layout
+    wait_idle();
+
+    for (auto &variant : variants)
+    {
+        vkDestroyPipeline(device, variant.pipeline, nullptr);
+        variant.pipeline = VK_NULL_HANDLE;
+    }
+
+    this->render_pass = render_pass;
+    this->layout = layout;
+
+    auto it = ids.find(fallback);
+    if (it == ids.end())
+    {
+        it = ids.emplace(fallback, static_cast<uint32_t>(variants.size())).first;
+        variants.push_back(Variant{fallback});
+    }
+    fallback_id = it->second;
+    variants[fallback_id].pipeline = build(fallback).pipeline;
+
+    for (auto &variant : variants)
+    {
+        if (variant.pipeline == VK_NULL_HANDLE)
+            compile(variant);
+    }
+}
+
+void PipelineRegistry::reload(const std::vector<std::vector<char>> &vertex_shaders, const std::vector<char> &fragment_shader)
+{
+    //compiles in flight read the modules, pipelines don't need them once they exist
+    wait_idle();
+
+    destroy_modules();
+    create_modules(vertex_shaders, fragment_shader);
+
+    for (auto &variant : variants)
+        compile(variant);
+}
+
+std::vector<VkPipeline> PipelineRegistry::take_retired()
+{
+    std::vector<VkPipeline> pipelines;
+    pipelines.swap(retired);
+    return pipelines;
+}
+
+uint32_t PipelineRegistry::request(const PipelineKey &key)
+{
+    auto it = ids.find(key);
+    if (it != ids.end())
+        return it->second;
+
+    uint32_t id = static_cast<uint32_t>(variants.size());
+    ids.emplace(key, id);
+    variants.push_back(Variant{key});
+
+    //without a render pass there's nothing to build against yet, set_render_pass() picks it up
+    if (render_pass != VK_NULL_HANDLE)
+        compile(variants.back());
+
+    return id;
+}
+
+VkPipeline PipelineRegistry::get(uint32_t id) const
+{
+    VkPipeline pipeline = variants[id].pipeline;
+    return pipeline != VK_NULL_HANDLE ? pipeline : variants[fallback_id].pipeline;
+}
+
+void PipelineRegistry::compile(Variant &variant)
+{
+    if (pending == 0)
+    {
+        batch_start = std::chrono::high_resolution_clock::now();
+        batch_count = 0;
+        batch_compile_ms = 0.0f;
+    }
+    pending++;
+
+    variant.compile = pool->submit([this, key = variant.key] { return build(key); });
+}
+
+/*A variant that fails to build keeps what it had, its old pipeline or the fallback. If that happens
+during a reload none of the replacements are swapped in, so the old shaders stay in use as a whole.*/
+void PipelineRegistry::finish(Variant &variant, bool wait)
+{
+    Compiled compiled{};
+    try
+    {
+        compiled = wait ? pool->wait(variant.compile) : variant.compile.get();
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "pipelines: " << e.what() << std::endl;
+        batch_failed = true;
+    }
+
+    if (variant.pipeline == VK_NULL_HANDLE)
+        variant.pipeline = compiled.pipeline;
+    else
+        variant.replacement = compiled.pipeline;
+
+    pending--;
+    batch_count++;
+    batch_compile_ms += compiled.ms;
+
+    if (pending != 0)
+        return;
+
+    //all at once, so no frame draws with a mix of old and new shaders
+    for (auto &other : variants)
+    {
+        if (other.replacement == VK_NULL_HANDLE)
+            continue;
+
+        if (batch_failed)
+        {
+            //never bound, nothing on the GPU can be using it
+            vkDestroyPipeline(device, other.replacement, nullptr);
+        }
+        else
+        {
+            retired.push_back(other.pipeline);
+            other.pipeline = other.replacement;
+        }
+        other.replacement = VK_NULL_HANDLE;
+    }
+
+    if (batch_failed)
+    {
+        batch_failed = false;
+        std::cout << "pipelines: kept the previous pipelines, " << batch_count << " variants attempted" << std::endl;
+        return;
+    }
+
+    float batch_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                         std::chrono::high_resolution_clock::now() - batch_start)
+                         .count();
+    std::cout << "pipelines: " << batch_count << " variants compiled in " << batch_ms << " ms, "
+              << batch_compile_ms << " ms if built one after another" << std::endl;
+}
+
+void PipelineRegistry::poll()
+{
+    if (pending == 0)
+        return;
+
+    for (auto &variant : variants)
+    {
+        if (variant.compile.valid() && variant.compile.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            finish(variant, false);
+    }
+}
+
+void PipelineRegistry::wait_idle()
+{
+    for (auto &variant : variants)
+    {
+        if (!variant.compile.valid())
+            continue;
+
+        //helps out with queued compiles instead of just blocking
+        finish(variant, true);
+    }
+}
+
+//runs on the pool, vkCreateGraphicsPipelines synchronizes access to the cache internally
+PipelineRegistry::Compiled PipelineRegistry::build(const PipelineKey &key) const
+{
+    const PipelineVertexInput &input = vertex_inputs.at(key.vertex_format);
+
+    //Shader Stages
+    VkPipelineShaderStageCreateInfo shader_stages[2]{};
+    shader_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shader_stages[0].module = vertex_modules[key.vertex_format];
+    shader_stages[0].pName = "main";
+
+    shader_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shader_stages[1].module = fragment_module;
+    shader_stages[1].pName = "main";
+
+    //Vertex Input
+    VkPipelineVertexInputStateCreateInfo vertex_input_info{};
+    vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input_info.vertexBindingDescriptionCount = 1;
+    vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(input.attributes.size());
+    vertex_input_info.pVertexBindingDescriptions = &input.binding;
+    vertex_input_info.pVertexAttributeDescriptions = input.attributes.data();
+
+    //Input Assembly
+    VkPipelineInputAssemblyStateCreateInfo input_assembly{};
+    input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    input_assembly.primitiveRestartEnable = VK_FALSE;
+
+    //Viewports and Scissors, dynamic so the pipeline doesn't depend on the swap chain extent
+    VkPipelineViewportStateCreateInfo viewport_state{};
+    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.viewportCount = 1;
+    viewport_state.scissorCount = 1;
+
+    std::array<VkDynamicState, 2> dynamic_states = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamic_state{};
+    dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_state.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
+    dynamic_state.pDynamicStates = dynamic_states.data();
+
+    //Rasterizer
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = key.wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.depthBiasClamp = VK_FALSE;
+
+    //Multisampling
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    //depth pass, blended surfaces test against it but don't write it
+    VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = VK_TRUE;
+    depth_stencil.depthWriteEnable = key.blend == BlendMode::opaque ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depth_stencil.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil.stencilTestEnable = VK_FALSE;
+
+    //Color blending
+    VkPipelineColorBlendAttachmentState color_blend_attachment{};
+    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    color_blend_attachment.blendEnable = key.blend == BlendMode::opaque ? VK_FALSE : VK_TRUE;
+    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    color_blend_attachment.dstColorBlendFactor = key.blend == BlendMode::additive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    if (key.depth_only)
+        color_blend_attachment.colorWriteMask = 0;
+
+    VkPipelineColorBlendStateCreateInfo color_blending{};
+    color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blending.logicOpEnable = VK_FALSE;
+    color_blending.logicOp = VK_LOGIC_OP_COPY; // Optional
+    color_blending.attachmentCount = 1;
+    color_blending.pAttachments = &color_blend_attachment;
+
+    //Pipline
+    VkGraphicsPipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.stageCount = key.depth_only ? 1 : 2;
+    pipeline_info.pStages = shader_stages;
+    pipeline_info.pVertexInputState = &vertex_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly;
+    pipeline_info.pViewportState = &viewport_state;
+    pipeline_info.pRasterizationState = &rasterizer;
+    pipeline_info.pMultisampleState = &multisampling;
+    pipeline_info.pDepthStencilState = &depth_stencil;
+    pipeline_info.pColorBlendState = &color_blending;
+    pipeline_info.pDynamicState = &dynamic_state;
+    pipeline_info.layout = layout;
+    pipeline_info.renderPass = render_pass;
+    pipeline_info.subpass = 0;
+    pipeline_info.basePipelineHandle = VK_NULL_HANDLE; // Optional
+    pipeline_info.basePipelineIndex = -1;              // Optional
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    Compiled compiled{};
+    if (vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info, nullptr, &compiled.pipeline) != VK_SUCCESS)
+        throw std::runtime_error("failed to create graphics pipeline!");
+
+    compiled.ms = std::chrono::duration<float, std::chrono::milliseconds::period>(
+                      std::chrono::high_resolution_clock::now() - t_start)
+                      .count();
+
+    return compiled;
+}
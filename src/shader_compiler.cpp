@@ -0,0 +1,100 @@
+#include "shader_compiler.h"
+#include "hash.h"
+
+#include <shaderc/shaderc.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <iterator>
+#include <stdexcept>
+#include <filesystem>
+
+#include <unistd.h>
+
+const uint32_t SPIRV_MAGIC = 0x07230203;
+
+static shaderc_shader_kind shader_kind(const std::string &source_path)
+{
+    std::string extension = std::filesystem::path(source_path).extension().string();
+    if (extension == ".vert")
+        return shaderc_glsl_vertex_shader;
+    if (extension == ".frag")
+        return shaderc_glsl_fragment_shader;
+
+    throw std::runtime_error("unknown shader stage for " + source_path + "!");
+}
+
+static std::string cache_path(const std::string &source, shaderc_shader_kind kind)
+{
+    uint64_t key = hash_bytes(source.data(), source.size(), mix64((uint64_t(SHADER_CACHE_VERSION) << 8) | kind));
+
+    std::stringstream ss;
+    ss << SHADER_CACHE_DIR << "/" << std::hex << key << ".spv";
+    return ss.str();
+}
+
+static bool load_cached(const std::string &path, std::vector<char> &spirv)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    spirv.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    uint32_t magic = 0;
+    if (spirv.size() >= sizeof(magic))
+        memcpy(&magic, spirv.data(), sizeof(magic));
+
+    return magic == SPIRV_MAGIC && spirv.size() % sizeof(uint32_t) == 0;
+}
+
+static void store_cached(const std::string &path, const std::vector<char> &spirv)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(SHADER_CACHE_DIR, ec);
+
+    //write then rename, threads compiling the same source at once just replace each other's result
+    std::stringstream tmp_path;
+    tmp_path << path << "." << getpid() << "." << std::this_thread::get_id() << ".tmp";
+
+    std::ofstream file(tmp_path.str(), std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return;
+
+    file.write(spirv.data(), spirv.size());
+    file.close();
+
+    if (!file || std::rename(tmp_path.str().c_str(), path.c_str()) != 0)
+        std::remove(tmp_path.str().c_str());
+}
+
+std::vector<char> compile_shader(const std::string &source_path)
+{
+    std::ifstream file(source_path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("failed to open " + source_path + "!");
+
+    std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    shaderc_shader_kind kind = shader_kind(source_path);
+
+    std::string path = cache_path(source, kind);
+    std::vector<char> spirv;
+    if (load_cached(path, spirv))
+        return spirv;
+
+    shaderc::Compiler compiler;
+    shaderc::CompileOptions options;
+    options.SetOptimizationLevel(shaderc_optimization_level_performance);
+
+    shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, source_path.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+        throw std::runtime_error("failed to compile " + source_path + ":\n" + result.GetErrorMessage());
+
+    spirv.assign(reinterpret_cast<const char *>(result.cbegin()), reinterpret_cast<const char *>(result.cend()));
+    store_cached(path, spirv);
+
+    return spirv;
+}
@@ -0,0 +1,66 @@
+#include "shader_watcher.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include <unistd.h>
+#include <sys/inotify.h>
+
+bool ShaderWatcher::watch(const std::string &directory)
+{
+    close();
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close();
+        return false;
+    }
+
+    this->directory = directory;
+    return true;
+}
+
+void ShaderWatcher::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+std::vector<std::string> ShaderWatcher::poll()
+{
+    std::vector<std::string> changed;
+    if (fd < 0)
+        return changed;
+
+    alignas(inotify_event) char buffer[4096];
+    for (;;)
+    {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break; //EAGAIN, nothing more queued
+
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->len == 0)
+                continue;
+
+            std::string extension = std::filesystem::path(event->name).extension().string();
+            if (extension != ".vert" && extension != ".frag")
+                continue;
+
+            std::string path = directory + "/" + event->name;
+            if (std::find(changed.begin(), changed.end(), path) == changed.end())
+                changed.push_back(path);
+        }
+    }
+
+    return changed;
+}
@@ -0,0 +1,344 @@
+#include "staging_ring.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+static VkCommandPool create_pool(VkDevice device, uint32_t queue_family)
+{
+    //batch command buffers are recycled, vkBeginCommandBuffer resets them
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = queue_family;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkCommandPool pool;
+    if (vkCreateCommandPool(device, &pool_info, nullptr, &pool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create staging command pool!");
+
+    return pool;
+}
+
+void StagingRing::create(VkDevice device, VkQueue queue, uint32_t queue_family, VkQueue acquire_queue, uint32_t acquire_family,
+                         VkBuffer buffer, uint8_t *mapped, VkDeviceSize size)
+{
+    this->device = device;
+    this->queue = queue;
+    this->queue_family = queue_family;
+    this->acquire_queue = acquire_queue;
+    this->acquire_family = acquire_family;
+    ring_buffer = buffer;
+    ring_size = size;
+    this->mapped = mapped;
+    head = 0;
+    used = 0;
+
+    command_pool = create_pool(device, queue_family);
+    upload_timeline = create_timeline_semaphore(device, 0);
+    transfer_timeline = upload_timeline;
+
+    if (ownership_transfer())
+    {
+        acquire_pool = create_pool(device, acquire_family);
+        transfer_timeline = create_timeline_semaphore(device, 0);
+    }
+}
+
+void StagingRing::destroy()
+{
+    if (device == VK_NULL_HANDLE)
+        return;
+
+    wait_idle();
+
+    //recorded but never submitted, nothing on the GPU refers to them
+    if (open_commands != VK_NULL_HANDLE)
+        vkFreeCommandBuffers(device, command_pool, 1, &open_commands);
+    if (open_acquire != VK_NULL_HANDLE)
+        vkFreeCommandBuffers(device, acquire_pool, 1, &open_acquire);
+    open_commands = VK_NULL_HANDLE;
+    open_acquire = VK_NULL_HANDLE;
+
+    if (transfer_timeline != upload_timeline)
+        vkDestroySemaphore(device, transfer_timeline, nullptr);
+    vkDestroySemaphore(device, upload_timeline, nullptr);
+    free_command_buffers.clear();
+    free_acquire_buffers.clear();
+
+    vkDestroyCommandPool(device, command_pool, nullptr);
+    if (acquire_pool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(device, acquire_pool, nullptr);
+
+    device = VK_NULL_HANDLE;
+    acquire_pool = VK_NULL_HANDLE;
+    upload_timeline = VK_NULL_HANDLE;
+    transfer_timeline = VK_NULL_HANDLE;
+    mapped = nullptr;
+}
+
+VkCommandBuffer StagingRing::begin(VkCommandPool pool, std::vector<VkCommandBuffer> &free_list)
+{
+    if (free_list.empty())
+    {
+        VkCommandBufferAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandPool = pool;
+        alloc_info.commandBufferCount = 1;
+
+        VkCommandBuffer command_buffer;
+        if (vkAllocateCommandBuffers(device, &alloc_info, &command_buffer) != VK_SUCCESS)
+            throw std::runtime_error("failed to allocate staging command buffer!");
+        free_list.push_back(command_buffer);
+    }
+
+    VkCommandBuffer command_buffer = free_list.back();
+    free_list.pop_back();
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+
+    return command_buffer;
+}
+
+VkCommandBuffer StagingRing::command_buffer()
+{
+    if (open_commands == VK_NULL_HANDLE)
+        open_commands = begin(command_pool, free_command_buffers);
+
+    return open_commands;
+}
+
+VkCommandBuffer StagingRing::acquire_command_buffer()
+{
+    if (!ownership_transfer())
+        return command_buffer();
+
+    //the transfer half has to exist too, it signals the semaphore the acquire waits on
+    command_buffer();
+    if (open_acquire == VK_NULL_HANDLE)
+        open_acquire = begin(acquire_pool, free_acquire_buffers);
+
+    return open_acquire;
+}
+
+VkDeviceSize StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (size > ring_size)
+        throw std::runtime_error("staging allocation larger than the ring!");
+
+    poll();
+
+    if (used == 0)
+        head = 0;
+
+    for (;;)
+    {
+        //an allocation that doesn't fit before the end starts over at 0, the skipped tail counts as used
+        VkDeviceSize start = (head + alignment - 1) / alignment * alignment;
+        VkDeviceSize consumed = start + size <= ring_size ? start + size - head : ring_size - head + size;
+        if (start + size > ring_size)
+            start = 0;
+
+        if (used + consumed <= ring_size)
+        {
+            command_buffer();
+
+            head = start + size;
+            used += consumed;
+            open_bytes += consumed;
+            return start;
+        }
+
+        //acquires flushed early still hold their batch's bytes, and those are older than any still transferring
+        if (std::any_of(acquiring.begin(), acquiring.end(), [](const Batch &batch) { return batch.reclaim; }))
+            finish_acquire(true);
+        else
+        {
+            //the open batch holds everything that's left, it has to go before its bytes can come back
+            if (transferring.empty())
+                submit();
+
+            finish_transfer(true);
+        }
+        if (used == 0)
+            head = 0;
+    }
+}
+
+uint64_t StagingRing::submit()
+{
+    if (open_commands == VK_NULL_HANDLE)
+        return submitted;
+
+    //every batch goes through both queues so they complete in order, even one with nothing to acquire
+    if (ownership_transfer())
+        acquire_command_buffer();
+
+    Batch batch{};
+    batch.command_buffer = open_commands;
+    batch.acquire_command_buffer = open_acquire;
+    batch.bytes = open_bytes;
+    batch.serial = ++submitted;
+
+    vkEndCommandBuffer(batch.command_buffer);
+    if (batch.acquire_command_buffer != VK_NULL_HANDLE)
+        vkEndCommandBuffer(batch.acquire_command_buffer);
+
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &batch.serial;
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &transfer_timeline;
+
+    if (vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("failed to submit staging copies!");
+
+    transferring.push_back(batch);
+    open_commands = VK_NULL_HANDLE;
+    open_acquire = VK_NULL_HANDLE;
+    open_bytes = 0;
+
+    return submitted;
+}
+
+void StagingRing::poll()
+{
+    if (!transferring.empty())
+    {
+        uint64_t transferred = timeline_value(device, transfer_timeline);
+        while (!transferring.empty() && transferring.front().serial <= transferred)
+            finish_transfer(false);
+    }
+
+    if (!acquiring.empty())
+    {
+        uint64_t acquired = timeline_value(device, upload_timeline);
+        while (!acquiring.empty() && acquiring.front().serial <= acquired)
+            finish_acquire(false);
+    }
+}
+
+bool StagingRing::is_complete(uint64_t batch)
+{
+    poll();
+
+    return batch <= completed;
+}
+
+void StagingRing::wait(uint64_t batch)
+{
+    while (completed < batch)
+    {
+        if (!acquiring.empty())
+            finish_acquire(true);
+        else if (!transferring.empty())
+            finish_transfer(true);
+        else
+            break;
+    }
+}
+
+void StagingRing::wait_idle()
+{
+    wait(submitted);
+}
+
+void StagingRing::flush(uint64_t batch)
+{
+    poll();
+
+    //without ownership transfer the copies signal timeline() themselves
+    if (!ownership_transfer())
+        return;
+
+    /*copies still running get their acquire now, waiting on them on the GPU. Their bytes and command
+    buffer come back with the acquire, which can't complete before the copies have*/
+    while (!transferring.empty() && transferring.front().serial <= batch)
+    {
+        Batch pending = transferring.front();
+        transferring.pop_front();
+
+        pending.reclaim = true;
+        submit_acquire(pending);
+    }
+}
+
+//the staging bytes are free as soon as the copies are done, the acquire (if any) goes to the graphics queue now
+void StagingRing::finish_transfer(bool wait)
+{
+    Batch batch = transferring.front();
+    transferring.pop_front();
+
+    if (wait)
+        wait_timeline(device, transfer_timeline, batch.serial);
+
+    used -= batch.bytes;
+    free_command_buffers.push_back(batch.command_buffer);
+
+    if (batch.acquire_command_buffer == VK_NULL_HANDLE)
+    {
+        //same queue family, done
+        completed = batch.serial;
+        return;
+    }
+
+    submit_acquire(batch);
+}
+
+void StagingRing::submit_acquire(const Batch &batch)
+{
+    //orders the acquire after the release, already reached unless flush() got there first
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timeline_info.waitSemaphoreValueCount = 1;
+    timeline_info.pWaitSemaphoreValues = &batch.serial;
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &batch.serial;
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitSemaphores = &transfer_timeline;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.acquire_command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &upload_timeline;
+
+    if (vkQueueSubmit(acquire_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("failed to submit staging acquire!");
+
+    acquiring.push_back(batch);
+}
+
+void StagingRing::finish_acquire(bool wait)
+{
+    Batch batch = acquiring.front();
+    acquiring.pop_front();
+
+    if (wait)
+        wait_timeline(device, upload_timeline, batch.serial);
+
+    //the acquire waited for the copies, so they are done too
+    if (batch.reclaim)
+    {
+        used -= batch.bytes;
+        free_command_buffers.push_back(batch.command_buffer);
+    }
+
+    free_acquire_buffers.push_back(batch.acquire_command_buffer);
+    completed = batch.serial;
+}
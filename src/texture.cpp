@@ -0,0 +1,325 @@
+#include "texture.h"
+#include "bc_encoder.h"
+#include "hash.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+struct Ktx2Header
+{
+    uint8_t identifier[12];
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_byte_offset;
+    uint32_t dfd_byte_length;
+    uint32_t kvd_byte_offset;
+    uint32_t kvd_byte_length;
+    uint64_t sgd_byte_offset;
+    uint64_t sgd_byte_length;
+};
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header is 80 bytes");
+
+struct Ktx2Level
+{
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    uint64_t uncompressed_byte_length;
+};
+
+const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+uint32_t block_size(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        return 8;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+size_t level_size(VkFormat format, uint32_t width, uint32_t height)
+{
+    uint32_t block = block_size(format);
+    if (block == 0)
+        return size_t(width) * height * 4; //rgba8
+
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * block;
+}
+
+VkDeviceSize pack_level_offsets(TextureData &texture, uint32_t level_count)
+{
+    texture.level_offsets.clear();
+
+    VkDeviceSize offset = 0;
+    for (uint32_t level = 0; level < level_count; level++)
+    {
+        texture.level_offsets.push_back(offset);
+        offset += level_size(texture.format, std::max(texture.width >> level, 1u), std::max(texture.height >> level, 1u));
+    }
+
+    return offset;
+}
+
+bool load_ktx2(const std::string &path, TextureData &texture, std::string *err)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+    {
+        *err = "failed to open " + path;
+        return false;
+    }
+
+    size_t file_size = static_cast<size_t>(file.tellg());
+    if (file_size < sizeof(Ktx2Header))
+    {
+        *err = path + " is too small for a KTX2 header";
+        return false;
+    }
+
+    texture.data.resize(file_size);
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(texture.data.data()), file_size);
+    if (!file)
+    {
+        *err = "failed to read " + path;
+        return false;
+    }
+
+    Ktx2Header header;
+    memcpy(&header, texture.data.data(), sizeof(header));
+    VkFormat format = static_cast<VkFormat>(header.vk_format);
+
+    if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+    {
+        *err = path + " is not a KTX2 file";
+        return false;
+    }
+    if (block_size(format) == 0 || header.supercompression_scheme != 0)
+    {
+        *err = path + ": only BC1/BC3/BC7 without supercompression are supported (vkFormat " +
+               std::to_string(header.vk_format) + ", scheme " + std::to_string(header.supercompression_scheme) + ")";
+        return false;
+    }
+    if (header.pixel_width == 0 || header.pixel_height == 0 || header.pixel_depth > 1 ||
+        header.layer_count > 1 || header.face_count != 1)
+    {
+        *err = path + ": only single 2D images are supported";
+        return false;
+    }
+
+    //0 asks the loader to generate levels, which compressed formats can't blit
+    uint32_t level_count = std::max(header.level_count, 1u);
+    if (sizeof(Ktx2Header) + level_count * sizeof(Ktx2Level) > file_size)
+    {
+        *err = path + ": truncated level index";
+        return false;
+    }
+
+    texture.width = header.pixel_width;
+    texture.height = header.pixel_height;
+    texture.format = format;
+    texture.mip_levels = level_count;
+    texture.level_offsets.resize(level_count);
+
+    for (uint32_t i = 0; i < level_count; i++)
+    {
+        Ktx2Level level;
+        memcpy(&level, texture.data.data() + sizeof(Ktx2Header) + i * sizeof(Ktx2Level), sizeof(level));
+
+        size_t expected = level_size(format, std::max(texture.width >> i, 1u), std::max(texture.height >> i, 1u));
+        if (level.byte_length != expected || level.byte_offset > file_size || expected > file_size - level.byte_offset)
+        {
+            *err = path + ": level " + std::to_string(i) + " does not match its size";
+            return false;
+        }
+
+        texture.level_offsets[i] = level.byte_offset;
+    }
+
+    return true;
+}
+
+//KHR_DF_MODEL_BC1A and KHR_DF_MODEL_BC7 from the Khronos data format spec
+const uint32_t DF_MODEL_BC1A = 128;
+const uint32_t DF_MODEL_BC3 = 130;
+const uint32_t DF_MODEL_BC7 = 134;
+
+static uint32_t data_format_model(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+        return DF_MODEL_BC3;
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        return DF_MODEL_BC7;
+    default:
+        return DF_MODEL_BC1A;
+    }
+}
+
+static bool is_srgb(VkFormat format)
+{
+    return format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK ||
+           format == VK_FORMAT_BC3_SRGB_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK || format == VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+bool write_ktx2(const std::string &path, const TextureData &texture)
+{
+    uint32_t block = block_size(texture.format);
+    uint32_t level_count = static_cast<uint32_t>(texture.level_offsets.size());
+    if (block == 0 || level_count == 0)
+        return false;
+
+    //one descriptor block with a single sample covering the whole compressed block
+    uint32_t dfd[11] = {};
+    dfd[0] = sizeof(dfd);
+    dfd[1] = 0;                             //vendor 0 (Khronos), descriptor type 0
+    dfd[2] = 2 | (24 + 16) << 16;           //version 2, block size
+    dfd[3] = data_format_model(texture.format) | 1 << 8 | (is_srgb(texture.format) ? 2 : 1) << 16; //BT709 primaries, sRGB or linear
+    dfd[4] = 3 | 3 << 8;                    //4x4x1x1 texels, stored minus one
+    dfd[5] = block;                         //bytes in plane 0
+    dfd[7] = (block * 8 - 1) << 16;         //bit offset 0, bit length - 1, channel 0
+    dfd[9] = 0;                             //sample lower
+    dfd[10] = UINT32_MAX;                   //sample upper
+
+    Ktx2Header header{};
+    memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vk_format = static_cast<uint32_t>(texture.format);
+    header.type_size = 1;
+    header.pixel_width = texture.width;
+    header.pixel_height = texture.height;
+    header.face_count = 1;
+    header.level_count = level_count;
+    header.dfd_byte_offset = static_cast<uint32_t>(sizeof(Ktx2Header) + level_count * sizeof(Ktx2Level));
+    header.dfd_byte_length = sizeof(dfd);
+
+    //levels go smallest first, each aligned to the block size (a multiple of 4)
+    std::vector<Ktx2Level> levels(level_count);
+    uint64_t offset = header.dfd_byte_offset + header.dfd_byte_length;
+
+    for (uint32_t i = level_count; i-- > 0;)
+    {
+        offset = (offset + block - 1) / block * block;
+        uint64_t size = level_size(texture.format, std::max(texture.width >> i, 1u), std::max(texture.height >> i, 1u));
+        levels[i] = {offset, size, size};
+        offset += size;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+    //write then rename, the pid and thread keep concurrent writers of the same entry off each other's file
+    std::stringstream tmp_path;
+    tmp_path << path << "." << getpid() << "." << std::this_thread::get_id() << ".tmp";
+
+    std::ofstream file(tmp_path.str(), std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(levels.data()), levels.size() * sizeof(Ktx2Level));
+    file.write(reinterpret_cast<const char *>(dfd), sizeof(dfd));
+
+    uint64_t position = header.dfd_byte_offset + header.dfd_byte_length;
+    const char padding[16] = {};
+
+    for (uint32_t i = level_count; i-- > 0;)
+    {
+        file.write(padding, levels[i].byte_offset - position);
+        file.write(reinterpret_cast<const char *>(texture.data.data() + texture.level_offsets[i]), levels[i].byte_length);
+        position = levels[i].byte_offset + levels[i].byte_length;
+    }
+
+    file.close();
+
+    if (!file || std::rename(tmp_path.str().c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+std::string texture_cache_path(const std::string &source_path)
+{
+    struct stat st;
+    if (stat(source_path.c_str(), &st) != 0)
+        return "";
+
+    uint64_t key = hash_bytes(source_path.data(), source_path.size(), TEXTURE_CACHE_VERSION);
+    key = mix64(key ^ static_cast<uint64_t>(st.st_size));
+    key = mix64(key ^ (static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec));
+
+    std::stringstream ss;
+    ss << TEXTURE_CACHE_DIR << "/" << std::hex << key << ".ktx2";
+    return ss.str();
+}
+
+//block rows per pool job, small enough to spread one big level over every core
+const uint32_t BC_ROWS_PER_JOB = 16;
+
+TextureData compress_bc(const TextureData &rgba, ThreadPool &pool)
+{
+    bool bc7 = has_alpha(rgba.data.data() + rgba.level_offsets[0], size_t(rgba.width) * rgba.height);
+    bool srgb = rgba.format == VK_FORMAT_R8G8B8A8_SRGB;
+
+    TextureData bc;
+    bc.width = rgba.width;
+    bc.height = rgba.height;
+    bc.mip_levels = static_cast<uint32_t>(rgba.level_offsets.size());
+    if (bc7)
+        bc.format = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+    else
+        bc.format = srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    bc.data.resize(pack_level_offsets(bc, bc.mip_levels));
+
+    std::vector<std::future<void>> jobs;
+
+    for (uint32_t level = 0; level < bc.mip_levels; level++)
+    {
+        uint32_t width = std::max(rgba.width >> level, 1u);
+        uint32_t height = std::max(rgba.height >> level, 1u);
+        const uint8_t *source = rgba.data.data() + rgba.level_offsets[level];
+        uint8_t *blocks = bc.data.data() + bc.level_offsets[level];
+        uint32_t rows = (height + 3) / 4;
+
+        for (uint32_t row = 0; row < rows; row += BC_ROWS_PER_JOB)
+        {
+            uint32_t count = std::min(BC_ROWS_PER_JOB, rows - row);
+            jobs.push_back(pool.submit([=] { encode_bc_rows(source, width, height, bc7, row, count, blocks); }));
+        }
+    }
+
+    for (auto &job : jobs)
+        pool.wait(job);
+
+    return bc;
+}
@@ -0,0 +1,76 @@
+#include "timeline_semaphore.h"
+
+#include <stdexcept>
+
+static PFN_vkWaitSemaphoresKHR wait_semaphores = nullptr;
+static PFN_vkGetSemaphoreCounterValueKHR get_semaphore_counter_value = nullptr;
+
+void load_timeline_semaphore_functions(VkDevice device)
+{
+    wait_semaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+    get_semaphore_counter_value = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+
+    if (wait_semaphores == nullptr || get_semaphore_counter_value == nullptr)
+        throw std::runtime_error("failed to load timeline semaphore functions!");
+}
+
+VkResult wait_semaphoresKHR(
+    VkDevice device,
+    const VkSemaphoreWaitInfoKHR *p_wait_info,
+    uint64_t timeout)
+{
+    if (wait_semaphores != nullptr)
+        return wait_semaphores(device, p_wait_info, timeout);
+    else
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+VkResult get_semaphore_counter_valueKHR(
+    VkDevice device,
+    VkSemaphore semaphore,
+    uint64_t *p_value)
+{
+    if (get_semaphore_counter_value != nullptr)
+        return get_semaphore_counter_value(device, semaphore, p_value);
+    else
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+VkSemaphore create_timeline_semaphore(VkDevice device, uint64_t initial_value)
+{
+    VkSemaphoreTypeCreateInfoKHR type_info{};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    type_info.initialValue = initial_value;
+
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(device, &semaphore_info, nullptr, &semaphore) != VK_SUCCESS)
+        throw std::runtime_error("failed to create timeline semaphore!");
+
+    return semaphore;
+}
+
+uint64_t timeline_value(VkDevice device, VkSemaphore semaphore)
+{
+    uint64_t value;
+    if (get_semaphore_counter_valueKHR(device, semaphore, &value) != VK_SUCCESS)
+        throw std::runtime_error("failed to read timeline semaphore!");
+
+    return value;
+}
+
+void wait_timeline(VkDevice device, VkSemaphore semaphore, uint64_t value)
+{
+    VkSemaphoreWaitInfoKHR wait_info{};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &semaphore;
+    wait_info.pValues = &value;
+
+    if (wait_semaphoresKHR(device, &wait_info, UINT64_MAX) != VK_SUCCESS)
+        throw std::runtime_error("failed to wait for timeline semaphore!");
+}
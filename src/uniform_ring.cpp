@@ -0,0 +1,54 @@
+#include "uniform_ring.h"
+
+#include <cstring>
+#include <stdexcept>
+
+//minUniformBufferOffsetAlignment is a power of two
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+VkDeviceSize UniformRing::buffer_size(uint32_t frame_count, VkDeviceSize alignment)
+{
+    return frame_count * align_up(UNIFORM_FRAME_SIZE, alignment);
+}
+
+void UniformRing::create(VkBuffer buffer, uint8_t *mapped, uint32_t frame_count, VkDeviceSize alignment)
+{
+    ring_buffer = buffer;
+    this->mapped = mapped;
+    this->frame_count = frame_count;
+    this->alignment = alignment;
+    frame_stride = align_up(UNIFORM_FRAME_SIZE, alignment);
+    frame_begin = 0;
+    head = 0;
+}
+
+void UniformRing::destroy()
+{
+    ring_buffer = VK_NULL_HANDLE;
+    mapped = nullptr;
+    frame_count = 0;
+}
+
+void UniformRing::begin_frame(uint32_t frame)
+{
+    if (frame >= frame_count)
+        throw std::runtime_error("uniform ring frame out of range!");
+
+    frame_begin = frame * frame_stride;
+    head = frame_begin;
+}
+
+uint32_t UniformRing::push(const void *data, VkDeviceSize size)
+{
+    if (head + size > frame_begin + UNIFORM_FRAME_SIZE)
+        throw std::runtime_error("uniform ring frame is full!");
+
+    VkDeviceSize offset = head;
+    memcpy(mapped + offset, data, size);
+    head = align_up(offset + size, alignment);
+
+    return static_cast<uint32_t>(offset);
+}